@@ -4,9 +4,12 @@
 
 #include "animationplayer.h"
 
+#include "jobsystem.h"
+
 #include <QTimer>
 
-#include <set>
+#include <algorithm>
+#include <cstring>
 
 static constexpr float axisFactor(MMD_Animation::Axis axis)
 {
@@ -25,6 +28,52 @@ static constexpr float axisFactor(MMD_Animation::Axis axis)
   }
 }
 
+/**
+ * @brief copies a rectangle of an image to another location, one scanline at a time
+ * @return the region of the image that was written
+ *
+ * The source and destination may overlap.
+ */
+static QRect copy_rect(QImage& image, const QRect& source, const QPoint& dest)
+{
+  int sx = source.x();
+  int sy = source.y();
+  int dx = dest.x();
+  int dy = dest.y();
+  int w = source.width();
+  int h = source.height();
+
+  // clip both rectangles to the image
+  const int left = std::max(-std::min(sx, dx), 0);
+  const int top = std::max(-std::min(sy, dy), 0);
+  sx += left;
+  dx += left;
+  sy += top;
+  dy += top;
+  w = std::min({w - left, image.width() - sx, image.width() - dx});
+  h = std::min({h - top, image.height() - sy, image.height() - dy});
+
+  if (w <= 0 || h <= 0)
+  {
+    return QRect();
+  }
+
+  const int bytes_per_pixel = image.depth() / 8;
+
+  // when moving down, go bottom-up so that source lines are read before being overwritten
+  const bool bottom_up = dy > sy;
+
+  for (int i(0); i < h; ++i)
+  {
+    const int row = bottom_up ? h - 1 - i : i;
+    uchar* dst = image.scanLine(dy + row) + dx * bytes_per_pixel;
+    const uchar* src = image.constScanLine(sy + row) + sx * bytes_per_pixel;
+    std::memmove(dst, src, w * bytes_per_pixel);
+  }
+
+  return QRect(dx, dy, w, h);
+}
+
 class AnimInstructionExecutor
 {
 public:
@@ -94,36 +143,25 @@ public:
     const int width = ins.width * 4;
     const int height = ins.height;
 
-    std::set<PSX_Material*> done;
+    CharacterModel& model = *this->data.model;
 
-    for (Object3D* node : this->data.model->nodes)
+    if (model.animatedVram)
     {
-      if (auto* psxobj = dynamic_cast<PSX_Object3D*>(node))
+      // with VRAM emulation, the copy is done in VRAM units
+      // relative to the character's TIM.
+      const int x = model.info.texture.getPixelX();
+      const int y = model.info.texture.getPixelY();
+      model.animatedVram->vram.copy(x + ins.srcX, y + ins.srcY, ins.width, ins.height, x + ins.destX, y + ins.destY);
+      model.animatedVram->markDirty(QRect(x + ins.destX, y + ins.destY, ins.width, ins.height));
+    }
+
+    for (PSX_Texture* texture : model.animatedTextures)
+    {
+      const QRect dirty = copy_rect(texture->image, QRect(srcX, srcY, width, height), QPoint(destX, destY));
+
+      if (!dirty.isEmpty())
       {
-        for (std::shared_ptr<PSX_Material> material : psxobj->materials)
-        {
-          if (material->map)
-          {
-            if (done.find(material.get()) != done.end())
-            {
-              continue;
-            }
-
-            QImage& image = material->map->image;
-
-            for (int y(0); y < height; ++y)
-            {
-              for (int x(0); x < width; ++x)
-              {
-                auto pixel = image.pixel(x + srcX, y + srcY);
-                image.setPixel(x + destX, y + destY, pixel);
-              }
-            }
-
-            ++(material->map->revision);
-            done.insert(material.get());
-          }
-        }
+        texture->markDirty(dirty);
       }
     }
   }
@@ -162,55 +200,75 @@ std::optional<int> get_timecode(const MMD_Animation::Instruction& instruction)
   return std::nullopt;
 }
 
-AnimationPlayer::AnimationPlayer(CharacterModel& model, QObject* parent)
-    : QObject(parent)
+static QVector3D get_position(const AnimationMomentumData& momentum)
 {
-  m_animationData.model = &model;
+  return QVector3D(momentum.values[static_cast<int>(MMD_Animation::Axis::POS_X)],
+                   momentum.values[static_cast<int>(MMD_Animation::Axis::POS_Y)],
+                   momentum.values[static_cast<int>(MMD_Animation::Axis::POS_Z)]);
+}
 
-  m_timer = new QTimer(this);
-  m_timer->setSingleShot(false);
-  m_timer->setInterval(50);
-  connect(m_timer, &QTimer::timeout, this, &AnimationPlayer::onTimerTimeout);
+static QVector3D get_scale(const AnimationMomentumData& momentum)
+{
+  return QVector3D(momentum.values[static_cast<int>(MMD_Animation::Axis::SCALE_X)],
+                   momentum.values[static_cast<int>(MMD_Animation::Axis::SCALE_Y)],
+                   momentum.values[static_cast<int>(MMD_Animation::Axis::SCALE_Z)]);
 }
 
-void AnimationPlayer::playAnimation(int index)
+static EulerAngles get_rotation(const AnimationMomentumData& momentum)
 {
-  const std::vector<MMD_Animation>& anims = m_animationData.model->animations;
-  if (index < 0 || index >= anims.size())
-  {
-    return;
-  }
+  return EulerAngles(momentum.values[static_cast<int>(MMD_Animation::Axis::ROT_X)],
+                     momentum.values[static_cast<int>(MMD_Animation::Axis::ROT_Y)],
+                     momentum.values[static_cast<int>(MMD_Animation::Axis::ROT_Z)]);
+}
 
-  playAnimation(anims[index]);
+QMatrix4x4 AnimationNodePose::matrix() const
+{
+  // same as Object3D::matrix()
+  QMatrix4x4 m;
+  m.translate(position);
+  m.rotate(rotation.toQuaternion());
+  m.scale(scale);
+  return m;
 }
 
-void AnimationPlayer::playAnimation(const MMD_Animation& animation)
+AnimationSimulation::AnimationSimulation(const CharacterModel& model, const MMD_Animation& animation)
+    : m_pose(model.nodes.size())
 {
-  m_animationData.model->setupAnimation(animation);
+  // nodes without an initial position keep their current transform
+  for (size_t i(0); i < m_pose.size(); ++i)
+  {
+    const Object3D& node = *model.nodes[i];
+    m_pose[i] = AnimationNodePose{node.position(), node.scale(), node.rotation()};
+  }
 
-  m_animationData.animation = animation;
+  for (size_t i(0); i < animation.initialPositions.size() && i < m_pose.size(); ++i)
+  {
+    const MMD_Animation::Position& pose = animation.initialPositions[i];
+    m_pose[i].position = QVector3D(pose.posX, pose.posY, pose.posZ);
+    m_pose[i].scale = QVector3D(pose.scaleX, pose.scaleY, pose.scaleZ) / float(0x1000);
+    m_pose[i].rotation = EulerAngles(QVector3D(pose.rotX, pose.rotY, pose.rotZ) * 360 / float(0x1000));
+  }
 
-  m_animationData.state = AnimationState();
-  m_animationData.state.momentumData.resize(m_animationData.model->nodes.size());
-  for (MomentumData& momentum : m_animationData.state.momentumData)
+  m_data.animation = animation;
+  m_data.state.momentumData.resize(m_pose.size());
+  for (AnimationMomentumData& momentum : m_data.state.momentumData)
   {
     std::fill(momentum.values.begin(), momentum.values.end(), 0.f);
   }
-
-  m_timer->start();
 }
 
-void AnimationPlayer::onTimerTimeout()
+void AnimationSimulation::step(const InstructionHandler& handler)
 {
-  step();
-}
+  AnimationState& state = m_data.state;
+  const MMD_Animation& animation = m_data.animation;
 
-void AnimationPlayer::step()
-{
-  applyMomentum();
-
-  AnimationState& state = m_animationData.state;
-  const MMD_Animation& animation = m_animationData.animation;
+  for (size_t i(0); i < m_pose.size(); ++i)
+  {
+    const AnimationMomentumData& momentum = state.momentumData[i];
+    m_pose[i].position += get_position(momentum);
+    m_pose[i].scale += get_scale(momentum);
+    m_pose[i].rotation = m_pose[i].rotation + get_rotation(momentum);
+  }
 
   state.frameNum += 1;
   state.timecode += 1;
@@ -221,52 +279,397 @@ void AnimationPlayer::step()
   while (state.pc < animation.instructions.size()
          && get_timecode(animation.instructions[state.pc]).value_or(timecode) == timecode)
   {
-    execute(m_animationData, animation.instructions[state.pc]);
+    const MMD_Animation::Instruction& instruction = animation.instructions[state.pc];
+
+    if (handler && !handler(instruction))
+    {
+      return;
+    }
+
+    // the others write to the model, which the simulation does not have
+    if (std::holds_alternative<MMD_Animation::KeyframeInstruction>(instruction)
+        || std::holds_alternative<MMD_Animation::LoopStartInstruction>(instruction)
+        || std::holds_alternative<MMD_Animation::LoopEndInstruction>(instruction))
+    {
+      execute(m_data, instruction);
+    }
+
     ++state.pc;
   }
+}
+
+// an animation that neither ends nor loops is cut after that many frames
+static constexpr int MAX_BAKED_FRAMES = 4096;
+
+static void record_frame(BakedAnimations& result,
+                         const CharacterModel& model,
+                         const std::vector<AnimationNodePose>& pose,
+                         std::vector<QMatrix4x4>& transforms)
+{
+  for (size_t i(0); i < pose.size(); ++i)
+  {
+    const SkeletonNodeRel& rel = model.info.skeleton[i];
+    const QMatrix4x4 local = pose[i].matrix();
+
+    // parents come before their children, see CharacterModel
+    transforms[i] = rel.parent == 255 ? local : transforms[rel.parent] * local;
+
+    if (auto* psxobj = dynamic_cast<const PSX_Object3D*>(model.nodes[i]))
+    {
+      result.bounds = united(result.bounds, psxobj->mesh->bounds * transforms[i]);
+    }
+  }
+
+  result.appendFrame(transforms);
+}
+
+static BakedAnimations::Clip bake_animation(BakedAnimations& result,
+                                            const CharacterModel& model,
+                                            const MMD_Animation& animation)
+{
+  AnimationSimulation simulation{model, animation};
+  std::vector<QMatrix4x4> transforms(model.nodes.size());
+
+  BakedAnimations::Clip clip;
+  clip.firstFrame = result.frameCount;
+
+  record_frame(result, model, simulation.pose(), transforms);
+
+  int loop_start_frame = -1;
+  bool looping = false;
+
+  while (!looping && !simulation.finished() && result.frameCount - clip.firstFrame < MAX_BAKED_FRAMES)
+  {
+    // the frame that is recorded at the end of this step
+    const int frame = result.frameCount - clip.firstFrame;
+
+    simulation.step([&](const MMD_Animation::Instruction& instruction) {
+      if (std::holds_alternative<MMD_Animation::LoopStartInstruction>(instruction))
+      {
+        // the loop resumes with the step following this one
+        loop_start_frame = frame + 1;
+      }
+      else if (std::holds_alternative<MMD_Animation::LoopEndInstruction>(instruction)
+               && (simulation.state().loopCounter == 255 || simulation.state().loopCounter == 0))
+      {
+        // an infinite loop, the clip repeats the frames baked since its start
+        looping = true;
+        return false;
+      }
+
+      return true;
+    });
+
+    record_frame(result, model, simulation.pose(), transforms);
+  }
+
+  clip.frameCount = result.frameCount - clip.firstFrame;
+
+  if (looping && loop_start_frame != -1)
+  {
+    clip.loopStart = std::min(loop_start_frame, clip.frameCount - 1);
+  }
+
+  return clip;
+}
+
+std::shared_ptr<BakedAnimations> bake_animations(const CharacterModel& model)
+{
+  const int node_count = int(model.nodes.size());
+
+  // each animation is baked on its own, the clips are then stacked in order
+  std::vector<BakedAnimations> parts(model.animations.size(), BakedAnimations(node_count));
+
+  JobSystem::instance().parallelFor(model.animations.size(), 1, [&](size_t begin, size_t end) {
+    for (size_t i(begin); i < end; ++i)
+    {
+      parts[i].clips.push_back(bake_animation(parts[i], model, model.animations[i]));
+    }
+  });
+
+  auto result = std::make_shared<BakedAnimations>(node_count);
+
+  for (BakedAnimations& part : parts)
+  {
+    BakedAnimations::Clip clip = part.clips.front();
+    clip.firstFrame += result->frameCount;
+    result->clips.push_back(clip);
+
+    result->texels.insert(result->texels.end(), part.texels.begin(), part.texels.end());
+    result->frameCount += part.frameCount;
+    result->bounds = united(result->bounds, part.bounds);
+  }
+
+  return result;
+}
+
+std::vector<AnimationChannel::TextureEvent> AnimationChannel::takeTextureEvents(int frameNum)
+{
+  QMutexLocker lock{&m_mutex};
+
+  // events are queued in frame order
+  auto it = std::find_if(m_texture_events.begin(), m_texture_events.end(), [frameNum](const TextureEvent& e) {
+    return e.frameNum > frameNum;
+  });
+
+  std::vector<TextureEvent> result{m_texture_events.begin(), it};
+  m_texture_events.erase(m_texture_events.begin(), it);
+  return result;
+}
+
+bool AnimationChannel::takeFinished()
+{
+  return m_finished.exchange(false, std::memory_order_acq_rel);
+}
+
+static void publish_pose(AnimationChannel& channel, const AnimationSimulation& simulation)
+{
+  AnimationPose& pose = channel.poses.writeBuffer();
+  pose.frameNum = simulation.state().frameNum;
+  pose.nodes = simulation.pose();
+  channel.poses.publish();
+}
+
+AnimationWorker::AnimationWorker()
+{
+  // moved to the worker's thread along with it
+  m_timer = new QTimer(this);
+  m_timer->setSingleShot(false);
+  m_timer->setInterval(50);
+  connect(m_timer, &QTimer::timeout, this, &AnimationWorker::step);
+}
+
+void AnimationWorker::add(std::shared_ptr<AnimationChannel> channel)
+{
+  m_channels.push_back(std::move(channel));
+}
+
+void AnimationWorker::remove(AnimationChannel* channel)
+{
+  auto it = std::find_if(m_channels.begin(), m_channels.end(), [channel](const std::shared_ptr<AnimationChannel>& c) {
+    return c.get() == channel;
+  });
+
+  if (it != m_channels.end())
+  {
+    m_channels.erase(it);
+  }
+}
+
+void AnimationWorker::play(AnimationChannel* channel, const AnimationSimulation& simulation)
+{
+  {
+    QMutexLocker lock{&channel->m_mutex};
+    channel->m_texture_events.clear();
+  }
+
+  channel->m_finished.store(false, std::memory_order_release);
+  channel->m_simulation = simulation;
+  channel->m_playing = true;
+  publish_pose(*channel, channel->m_simulation);
 
   Q_EMIT stepped();
 
-  if (state.pc == animation.instructions.size())
+  if (!m_timer->isActive())
+  {
+    m_timer->start();
+  }
+}
+
+void AnimationWorker::stop(AnimationChannel* channel)
+{
+  channel->m_playing = false;
+}
+
+void AnimationWorker::step()
+{
+  std::vector<AnimationChannel*> active;
+
+  for (const std::shared_ptr<AnimationChannel>& channel : m_channels)
+  {
+    if (channel->m_playing)
+    {
+      active.push_back(channel.get());
+    }
+  }
+
+  if (active.empty())
   {
     m_timer->stop();
-    Q_EMIT finished();
+    return;
   }
+
+  // one contiguous share of the channels per thread, this one included
+  const size_t shares = size_t(JobSystem::instance().workerCount()) + 1;
+  const size_t grain = (active.size() + shares - 1) / shares;
+
+  JobSystem::instance().parallelFor(active.size(), grain, [&active](size_t begin, size_t end) {
+    for (size_t i(begin); i < end; ++i)
+    {
+      AnimationChannel& channel = *active[i];
+      const int frame = channel.m_simulation.state().frameNum + 1;
+
+      channel.m_simulation.step([&channel, frame](const MMD_Animation::Instruction& instruction) {
+        if (auto* ins = std::get_if<MMD_Animation::TextureInstruction>(&instruction))
+        {
+          QMutexLocker lock{&channel.m_mutex};
+          channel.m_texture_events.push_back(AnimationChannel::TextureEvent{frame, *ins});
+        }
+
+        return true;
+      });
+
+      publish_pose(channel, channel.m_simulation);
+
+      if (channel.m_simulation.finished())
+      {
+        channel.m_playing = false;
+
+        // after the last pose was published, see AnimationPlayer::sync()
+        channel.m_finished.store(true, std::memory_order_release);
+      }
+    }
+  });
+
+  Q_EMIT stepped();
 }
 
-static QVector3D get_position(const AnimationMomentumData& momentum)
+AnimationPlayer::AnimationPlayer(CharacterModel& model, QObject* parent)
+    : QObject(parent)
+    , m_channel(std::make_shared<AnimationChannel>())
 {
-  return QVector3D(momentum.values[static_cast<int>(MMD_Animation::Axis::POS_X)],
-                   momentum.values[static_cast<int>(MMD_Animation::Axis::POS_Y)],
-                   momentum.values[static_cast<int>(MMD_Animation::Axis::POS_Z)]);
+  m_animationData.model = &model;
+
+  AnimationSystem& system = AnimationSystem::instance();
+  system.add(this);
+
+  QMetaObject::invokeMethod(system.worker(), [worker = system.worker(), channel = m_channel]() {
+    worker->add(channel);
+  });
 }
 
-static QVector3D get_scale(const AnimationMomentumData& momentum)
+AnimationPlayer::~AnimationPlayer()
 {
-  return QVector3D(momentum.values[static_cast<int>(MMD_Animation::Axis::SCALE_X)],
-                   momentum.values[static_cast<int>(MMD_Animation::Axis::SCALE_Y)],
-                   momentum.values[static_cast<int>(MMD_Animation::Axis::SCALE_Z)]);
+  AnimationSystem& system = AnimationSystem::instance();
+  system.remove(this);
+
+  // the worker keeps the channel alive until then
+  QMetaObject::invokeMethod(system.worker(), [worker = system.worker(), channel = m_channel.get()]() {
+    worker->remove(channel);
+  });
 }
 
-static EulerAngles get_rotation(const AnimationMomentumData& momentum)
+void AnimationPlayer::playAnimation(int index)
 {
-  return EulerAngles(momentum.values[static_cast<int>(MMD_Animation::Axis::ROT_X)],
-                     momentum.values[static_cast<int>(MMD_Animation::Axis::ROT_Y)],
-                     momentum.values[static_cast<int>(MMD_Animation::Axis::ROT_Z)]);
+  const std::vector<MMD_Animation>& anims = m_animationData.model->animations;
+  if (index < 0 || index >= anims.size())
+  {
+    return;
+  }
+
+  playAnimation(anims[index]);
 }
 
-void AnimationPlayer::applyMomentum()
+void AnimationPlayer::playAnimation(const MMD_Animation& animation)
+{
+  m_animationData.model->setupAnimation(animation);
+
+  AnimationSimulation simulation{*m_animationData.model, animation};
+  AnimationWorker* worker = AnimationSystem::instance().worker();
+
+  QMetaObject::invokeMethod(worker,
+                            [worker, channel = m_channel.get(), simulation = std::move(simulation)]() {
+                              worker->play(channel, simulation);
+                            });
+}
+
+void AnimationPlayer::sync()
+{
+  // read first, the last pose is published before the flag is set
+  const bool done = m_channel->takeFinished();
+
+  if (m_channel->poses.update())
+  {
+    const AnimationPose& pose = m_channel->poses.readBuffer();
+    applyPose(pose);
+
+    for (const AnimationChannel::TextureEvent& event : m_channel->takeTextureEvents(pose.frameNum))
+    {
+      execute(m_animationData, event.instruction);
+    }
+
+    Q_EMIT stepped();
+  }
+
+  if (done)
+  {
+    Q_EMIT finished();
+  }
+}
+
+void AnimationPlayer::applyPose(const AnimationPose& pose)
 {
-  AnimationState& state = m_animationData.state;
   CharacterModel& model = *m_animationData.model;
 
-  for (size_t i(0); i < state.momentumData.size(); ++i)
+  for (size_t i(0); i < pose.nodes.size() && i < model.nodes.size(); ++i)
   {
-    MomentumData& momentum = state.momentumData[i];
+    const AnimationNodePose& p = pose.nodes[i];
     Object3D& node = *model.nodes[i];
 
-    node.setPosition(node.position() + get_position(momentum));
-    node.setScale(node.scale() + get_scale(momentum));
-    node.setRotation(node.rotation() + get_rotation(momentum));
+    node.setPosition(p.position);
+    node.setScale(p.scale);
+    node.setRotation(p.rotation);
+  }
+}
+
+AnimationSystem::AnimationSystem()
+{
+  // constructed first, so that it is destroyed after the worker stops using it
+  JobSystem::instance();
+
+  m_worker = new AnimationWorker;
+  m_worker->moveToThread(&m_thread);
+  connect(&m_thread, &QThread::finished, m_worker, &QObject::deleteLater);
+
+  // queued, the slot runs in the GUI thread
+  connect(m_worker, &AnimationWorker::stepped, this, &AnimationSystem::sync);
+
+  m_thread.setObjectName("AnimationWorker");
+  m_thread.start();
+}
+
+AnimationSystem::~AnimationSystem()
+{
+  m_thread.quit();
+  m_thread.wait();
+}
+
+AnimationSystem& AnimationSystem::instance()
+{
+  static AnimationSystem system;
+  return system;
+}
+
+void AnimationSystem::add(AnimationPlayer* player)
+{
+  m_players.push_back(player);
+}
+
+void AnimationSystem::remove(AnimationPlayer* player)
+{
+  m_players.erase(std::remove(m_players.begin(), m_players.end(), player), m_players.end());
+}
+
+void AnimationSystem::sync()
+{
+  // a copy, slots connected to the players may destroy some of them
+  const std::vector<AnimationPlayer*> players = m_players;
+
+  for (AnimationPlayer* player : players)
+  {
+    if (std::find(m_players.begin(), m_players.end(), player) != m_players.end())
+    {
+      player->sync();
+    }
   }
 }
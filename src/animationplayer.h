@@ -5,10 +5,16 @@
 #pragma once
 
 #include "charactermodel.h"
+#include "triplebuffer.h"
 
+#include <QMutex>
 #include <QObject>
+#include <QThread>
 
 #include <array>
+#include <atomic>
+#include <functional>
+#include <memory>
 
 struct AnimationMomentumData
 {
@@ -35,12 +41,175 @@ struct AnimationData
   bool infinite = false;
 };
 
+/**
+ * @brief the local transform of a node, as written by animations
+ */
+struct AnimationNodePose
+{
+  QVector3D position;
+  QVector3D scale;
+  EulerAngles rotation;
+
+  QMatrix4x4 matrix() const;
+};
+
+/**
+ * @brief the pose of every node of a character at a given frame
+ */
+struct AnimationPose
+{
+  int frameNum = -1;
+  std::vector<AnimationNodePose> nodes;
+};
+
+/**
+ * @brief steps an animation on a pose of its own, without touching the model
+ *
+ * Keyframe and loop instructions are executed, the others are only
+ * passed to the handler given to step().
+ */
+class AnimationSimulation
+{
+public:
+  using InstructionHandler = std::function<bool(const MMD_Animation::Instruction&)>;
+
+  AnimationSimulation() = default;
+
+  /**
+   * @brief starts from the initial positions of the animation, as CharacterModel::setupAnimation() does
+   */
+  AnimationSimulation(const CharacterModel& model, const MMD_Animation& animation);
+
+  const AnimationState& state() const;
+  const std::vector<AnimationNodePose>& pose() const;
+  bool finished() const;
+
+  /**
+   * @brief applies the momentum of each node and executes the instructions of the next timecode
+   *
+   * The handler is called before each instruction is executed, the step
+   * stops at the instruction if it returns false.
+   */
+  void step(const InstructionHandler& handler);
+
+private:
+  AnimationData m_data;
+  std::vector<AnimationNodePose> m_pose;
+};
+
+inline const AnimationState& AnimationSimulation::state() const
+{
+  return m_data.state;
+}
+
+inline const std::vector<AnimationNodePose>& AnimationSimulation::pose() const
+{
+  return m_pose;
+}
+
+inline bool AnimationSimulation::finished() const
+{
+  return m_data.state.pc >= int(m_data.animation.instructions.size());
+}
+
+/**
+ * @brief evaluates every animation of a character ahead of time
+ *
+ * Each animation is stepped as AnimationPlayer would, from its initial
+ * positions, and becomes a clip of the result. Texture and sound
+ * instructions are ignored.
+ * An animation that loops forever is baked up to the end of its first
+ * iteration, and the clip then repeats that iteration.
+ */
+std::shared_ptr<BakedAnimations> bake_animations(const CharacterModel& model);
+
+/**
+ * @brief the state shared by an AnimationPlayer and the AnimationWorker stepping it
+ */
+class AnimationChannel
+{
+public:
+  struct TextureEvent
+  {
+    int frameNum;
+    MMD_Animation::TextureInstruction instruction;
+  };
+
+  TripleBuffer<AnimationPose> poses;
+
+  /**
+   * @brief removes and returns the texture instructions executed up to a frame
+   * @note this function is thread-safe
+   */
+  std::vector<TextureEvent> takeTextureEvents(int frameNum);
+
+  /**
+   * @brief returns whether the animation finished since the last call
+   * @note this function is thread-safe
+   */
+  bool takeFinished();
+
+private:
+  friend class AnimationWorker;
+
+  // only accessed by the worker's thread
+  AnimationSimulation m_simulation;
+  bool m_playing = false;
+
+  QMutex m_mutex; ///< protects 'm_texture_events'
+  std::vector<TextureEvent> m_texture_events;
+  std::atomic<bool> m_finished{false};
+};
+
+/**
+ * @brief steps the animations of every AnimationPlayer in a thread of its own
+ *
+ * Every 50 ms, the channels that are playing are partitioned across the
+ * threads of the JobSystem and stepped concurrently; each one writes the
+ * pose of its character to its own buffer. A single stepped() signal is
+ * then emitted for the whole batch, so that the cost of a tick grows
+ * with the number of characters divided by the number of cores.
+ */
+class AnimationWorker : public QObject
+{
+  Q_OBJECT
+
+public:
+  AnimationWorker();
+
+  void add(std::shared_ptr<AnimationChannel> channel);
+  void remove(AnimationChannel* channel);
+
+  void play(AnimationChannel* channel, const AnimationSimulation& simulation);
+  void stop(AnimationChannel* channel);
+
+Q_SIGNALS:
+  void stepped();
+
+protected:
+  void step();
+
+private:
+  QTimer* m_timer;
+  std::vector<std::shared_ptr<AnimationChannel>> m_channels;
+};
+
+/**
+ * @brief plays an animation on a CharacterModel
+ *
+ * The animation is stepped by the AnimationWorker of the AnimationSystem,
+ * along with those of the other players, so that a busy GUI thread does
+ * not slow it down. Poses reach the GUI thread through a TripleBuffer and
+ * are written to the nodes of the model by AnimationSystem::sync(); the
+ * scene is then only ever modified by the thread that renders it.
+ */
 class AnimationPlayer : public QObject
 {
   Q_OBJECT
 
 public:
   explicit AnimationPlayer(CharacterModel& model, QObject* parent = nullptr);
+  ~AnimationPlayer();
 
   using MomentumData = AnimationMomentumData;
 
@@ -53,14 +222,52 @@ Q_SIGNALS:
   void stepped();
   void finished();
 
-protected Q_SLOTS:
-  void onTimerTimeout();
-
 protected:
-  void step();
-  void applyMomentum();
+  friend class AnimationSystem;
+
+  /**
+   * @brief applies the latest pose published for this player, if any
+   */
+  void sync();
+
+  void applyPose(const AnimationPose& pose);
 
 private:
-  QTimer* m_timer;
-  AnimationData m_animationData;
+  AnimationData m_animationData; ///< target of the texture instructions
+  std::shared_ptr<AnimationChannel> m_channel;
+};
+
+/**
+ * @brief the AnimationWorker shared by all the players of the application
+ *
+ * When the worker has stepped a batch, the new poses of all the players
+ * are applied to their models in a single pass in the GUI thread.
+ */
+class AnimationSystem : public QObject
+{
+  Q_OBJECT
+
+public:
+  AnimationSystem();
+  ~AnimationSystem();
+
+  static AnimationSystem& instance();
+
+  AnimationWorker* worker() const;
+
+  void add(AnimationPlayer* player);
+  void remove(AnimationPlayer* player);
+
+protected Q_SLOTS:
+  void sync();
+
+private:
+  QThread m_thread;
+  AnimationWorker* m_worker;
+  std::vector<AnimationPlayer*> m_players;
 };
+
+inline AnimationWorker* AnimationSystem::worker() const
+{
+  return m_worker;
+}
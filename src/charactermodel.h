@@ -5,13 +5,14 @@
 #pragma once
 
 #include "rendering/psxobject3d.h"
+#include "rendering/vertexanimation.h"
 
 #include "gamereader.h"
 
 #include "converters/tmd2object3d.h"
 #include "formats/mmd.h"
 
-class CharacterModel : public Object3D
+class CharacterModel : public VertexAnimatedObject
 {
 public:
   CharacterEntry info;
@@ -19,30 +20,44 @@ public:
   std::vector<MMD_Animation> animations;
   std::vector<Object3D*> nodes;
 
+  // what texture animations write to, collected once at construction
+  std::vector<PSX_Texture*> animatedTextures;
+  PSX_Vram* animatedVram = nullptr;
+
 public:
   CharacterModel(const CharacterEntry& info, const MMD_File& mmd)
   {
     TMD_ModelConverter converter;
+    converter.setVramEmulation(true);
     converter.setTIMs({info.texture});
 
     this->mmd = mmd;
     this->nodes.reserve(info.skeleton.size());
 
+    // the meshes are converted in parallel, the hierarchy is then built in order
+    std::vector<const TMD_Object*> objects;
+    objects.reserve(info.skeleton.size());
+
     for (const SkeletonNodeRel& rel : info.skeleton)
     {
+      objects.push_back(rel.object != 255 ? &this->mmd.tmd.objects()[rel.object] : nullptr);
+    }
+
+    std::vector<std::unique_ptr<Object3D>> converted = converter.convertObjects(objects);
+
+    for (size_t i(0); i < info.skeleton.size(); ++i)
+    {
+      const SkeletonNodeRel& rel = info.skeleton[i];
+
       if (rel.parent == 255 && rel.object == 255)
       {
         this->nodes.push_back(this);
         continue;
       }
 
-      std::unique_ptr<Object3D> obj;
+      std::unique_ptr<Object3D> obj = std::move(converted[i]);
 
-      if (rel.object != 255)
-      {
-        obj = converter.convertObject(mmd.tmd.objects()[rel.object]);
-      }
-      else
+      if (!obj)
       {
         obj = std::make_unique<Group>();
       }
@@ -55,6 +70,8 @@ public:
     }
 
     this->animations = mmd.animations.decode(info.skeleton.size());
+
+    collectTextureTargets();
   }
 
   void setupAnimation(const MMD_Animation& animation)
@@ -71,4 +88,38 @@ public:
   }
 
   void setupAnimation(int index = 0) { setupAnimation(this->animations.at(index)); }
+
+  int animatedNodeIndex(const Object3D* node) const override
+  {
+    auto it = std::find(this->nodes.begin(), this->nodes.end(), node);
+    return it != this->nodes.end() ? int(std::distance(this->nodes.begin(), it)) : -1;
+  }
+
+private:
+  void collectTextureTargets()
+  {
+    for (Object3D* node : this->nodes)
+    {
+      auto* psxobj = dynamic_cast<PSX_Object3D*>(node);
+
+      if (!psxobj)
+      {
+        continue;
+      }
+
+      for (const std::shared_ptr<PSX_Material>& material : psxobj->materials)
+      {
+        if (material->vram)
+        {
+          this->animatedVram = material->vram.get();
+        }
+        else if (material->map
+                 && std::find(animatedTextures.begin(), animatedTextures.end(), material->map.get())
+                        == animatedTextures.end())
+        {
+          this->animatedTextures.push_back(material->map.get());
+        }
+      }
+    }
+  }
 };
@@ -0,0 +1,331 @@
+// Copyright (C) 2025 Vincent Chambrin
+// This file is part of the 'mmd-viewer' project
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "meshindexer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+
+namespace
+{
+
+struct VertexHash
+{
+  size_t operator()(const PSX_Vertex& v) const
+  {
+    uint64_t words[2];
+    std::memcpy(words, &v, sizeof(words));
+    return std::hash<uint64_t>()(words[0] * 0x9E3779B97F4A7C15ull ^ words[1]);
+  }
+};
+
+struct VertexEqual
+{
+  bool operator()(const PSX_Vertex& a, const PSX_Vertex& b) const
+  {
+    return std::memcmp(&a, &b, sizeof(PSX_Vertex)) == 0;
+  }
+};
+
+static_assert(sizeof(PSX_Vertex) == 2 * sizeof(uint64_t));
+
+// vertices that can be addressed with 16-bit indices
+constexpr size_t MAX_VERTEX_COUNT = 0x10000;
+
+constexpr int CACHE_SIZE = 32;
+
+float vertex_score(int cachePosition, int remainingTriangles)
+{
+  if (remainingTriangles == 0)
+  {
+    return -1.f;
+  }
+
+  float score = 0.f;
+
+  if (cachePosition >= 0)
+  {
+    // the last triangle's vertices get a fixed score so that the next
+    // triangle does not always share an edge with it.
+    if (cachePosition < 3)
+    {
+      score = 0.75f;
+    }
+    else
+    {
+      score = std::pow(1.f - float(cachePosition - 3) / (CACHE_SIZE - 3), 1.5f);
+    }
+  }
+
+  // favor vertices with few remaining triangles, to get rid of them
+  score += 2.f / std::sqrt(float(remainingTriangles));
+
+  return score;
+}
+
+} // namespace
+
+void index_mesh(PSX_Object3D& object)
+{
+  PSX_Mesh& mesh = *object.mesh;
+
+  const std::vector<PSX_Vertex> expanded = std::move(mesh.vertices);
+  mesh.vertices.clear();
+  mesh.indices.clear();
+  mesh.wideIndices.clear();
+
+  auto draw_type = [](PSX_Object3D::PrimitiveType type) {
+    return type == PSX_Object3D::Quad ? PSX_Object3D::Triangle : type;
+  };
+
+  // primitives with the same material and type end up in the same range
+  std::vector<PSX_Object3D::PrimitiveInfo> primitives = std::move(object.primitives);
+  std::stable_sort(primitives.begin(), primitives.end(), [&draw_type](const auto& a, const auto& b) {
+    return std::make_pair(a.materialIndex, draw_type(a.type)) < std::make_pair(b.materialIndex, draw_type(b.type));
+  });
+
+  // indices are built with 32 bits, and narrowed if the vertices fit
+  std::vector<uint32_t> indices;
+  indices.reserve(expanded.size());
+
+  std::unordered_map<PSX_Vertex, uint32_t, VertexHash, VertexEqual> welded;
+  welded.reserve(expanded.size());
+
+  std::vector<PSX_Object3D::PrimitiveInfo> ranges;
+
+  for (const PSX_Object3D::PrimitiveInfo& primitive : primitives)
+  {
+    const size_t first = indices.size();
+
+    for (int i(0); i < primitive.count; ++i)
+    {
+      const PSX_Vertex& v = expanded[primitive.index + i];
+      auto [it, inserted] = welded.try_emplace(v, uint32_t(mesh.vertices.size()));
+
+      if (inserted)
+      {
+        mesh.vertices.push_back(v);
+      }
+
+      indices.push_back(it->second);
+    }
+
+    const PSX_Object3D::PrimitiveType type = draw_type(primitive.type);
+
+    if (ranges.empty() || ranges.back().materialIndex != primitive.materialIndex || ranges.back().type != type)
+    {
+      PSX_Object3D::PrimitiveInfo range;
+      range.index = int(first);
+      range.count = 0;
+      range.type = type;
+      range.materialIndex = primitive.materialIndex;
+      ranges.push_back(range);
+    }
+
+    ranges.back().count += primitive.count;
+  }
+
+  for (const PSX_Object3D::PrimitiveInfo& range : ranges)
+  {
+    if (range.type == PSX_Object3D::Triangle)
+    {
+      optimize_vertex_cache(indices.data() + range.index, range.count, mesh.vertices.size());
+    }
+  }
+
+  // renumber the vertices in order of first use, so that vertex fetching
+  // goes through the buffer mostly linearly.
+  {
+    std::vector<int> remap(mesh.vertices.size(), -1);
+    std::vector<PSX_Vertex> vertices;
+    vertices.reserve(mesh.vertices.size());
+
+    for (uint32_t& index : indices)
+    {
+      if (remap[index] == -1)
+      {
+        remap[index] = int(vertices.size());
+        vertices.push_back(mesh.vertices[index]);
+      }
+
+      index = uint32_t(remap[index]);
+    }
+
+    mesh.vertices = std::move(vertices);
+  }
+
+  if (mesh.vertices.size() <= MAX_VERTEX_COUNT)
+  {
+    mesh.indices.assign(indices.begin(), indices.end());
+  }
+  else
+  {
+    mesh.wideIndices = std::move(indices);
+  }
+
+  object.primitives = std::move(ranges);
+}
+
+template<typename Index>
+static void optimize_vertex_cache_impl(Index* indices, size_t indexCount, size_t vertexCount)
+{
+  const size_t triangle_count = indexCount / 3;
+
+  if (triangle_count < 2)
+  {
+    return;
+  }
+
+  // triangles using each vertex, the first 'remaining[v]' entries
+  // starting at 'offsets[v]' are those that have not been emitted yet.
+  std::vector<int> remaining(vertexCount, 0);
+  std::vector<int> offsets(vertexCount + 1, 0);
+  std::vector<int> adjacency(triangle_count * 3);
+
+  for (size_t i(0); i < triangle_count * 3; ++i)
+  {
+    ++remaining[indices[i]];
+  }
+
+  for (size_t v(0); v < vertexCount; ++v)
+  {
+    offsets[v + 1] = offsets[v] + remaining[v];
+    remaining[v] = 0;
+  }
+
+  for (size_t i(0); i < triangle_count * 3; ++i)
+  {
+    const Index v = indices[i];
+    adjacency[offsets[v] + remaining[v]++] = int(i / 3);
+  }
+
+  std::vector<int> cache_position(vertexCount, -1);
+  std::vector<float> score(vertexCount);
+  std::vector<float> triangle_score(triangle_count, 0.f);
+  std::vector<bool> emitted(triangle_count, false);
+
+  for (size_t v(0); v < vertexCount; ++v)
+  {
+    score[v] = vertex_score(-1, remaining[v]);
+  }
+
+  for (size_t t(0); t < triangle_count; ++t)
+  {
+    triangle_score[t] = score[indices[3 * t]] + score[indices[3 * t + 1]] + score[indices[3 * t + 2]];
+  }
+
+  std::vector<Index> output;
+  output.reserve(triangle_count * 3);
+
+  std::vector<int> cache;
+  std::vector<int> next_cache;
+  cache.reserve(CACHE_SIZE + 3);
+  next_cache.reserve(CACHE_SIZE + 3);
+
+  int best = int(std::max_element(triangle_score.begin(), triangle_score.end()) - triangle_score.begin());
+  size_t scan_start = 0;
+
+  while (output.size() < triangle_count * 3)
+  {
+    if (best == -1)
+    {
+      // nothing in the cache has triangles left, pick the best remaining one
+      float best_score = -1.f;
+
+      for (size_t t = scan_start; t < triangle_count; ++t)
+      {
+        if (!emitted[t] && triangle_score[t] > best_score)
+        {
+          best_score = triangle_score[t];
+          best = int(t);
+        }
+      }
+
+      while (scan_start < triangle_count && emitted[scan_start])
+      {
+        ++scan_start;
+      }
+    }
+
+    emitted[best] = true;
+
+    next_cache.clear();
+
+    for (int k(0); k < 3; ++k)
+    {
+      const Index v = indices[3 * best + k];
+      output.push_back(v);
+
+      if (std::find(next_cache.begin(), next_cache.end(), v) == next_cache.end())
+      {
+        next_cache.push_back(v);
+      }
+
+      int* begin = adjacency.data() + offsets[v];
+      int* end = begin + remaining[v];
+      std::iter_swap(std::find(begin, end, best), end - 1);
+      --remaining[v];
+    }
+
+    for (int v : cache)
+    {
+      if (std::find(next_cache.begin(), next_cache.end(), v) == next_cache.end())
+      {
+        next_cache.push_back(v);
+      }
+    }
+
+    // vertices pushed out of the cache lose their cache bonus
+    for (size_t i = CACHE_SIZE; i < next_cache.size(); ++i)
+    {
+      cache_position[next_cache[i]] = -1;
+    }
+
+    best = -1;
+    float best_score = -1.f;
+
+    for (size_t i(0); i < next_cache.size(); ++i)
+    {
+      const int v = next_cache[i];
+
+      if (i < size_t(CACHE_SIZE))
+      {
+        cache_position[v] = int(i);
+      }
+
+      const float new_score = vertex_score(cache_position[v], remaining[v]);
+      const float delta = new_score - score[v];
+      score[v] = new_score;
+
+      for (int j(0); j < remaining[v]; ++j)
+      {
+        const int t = adjacency[offsets[v] + j];
+        triangle_score[t] += delta;
+
+        if (i < size_t(CACHE_SIZE) && triangle_score[t] > best_score)
+        {
+          best_score = triangle_score[t];
+          best = t;
+        }
+      }
+    }
+
+    next_cache.resize(std::min<size_t>(next_cache.size(), CACHE_SIZE));
+    std::swap(cache, next_cache);
+  }
+
+  std::copy(output.begin(), output.end(), indices);
+}
+
+void optimize_vertex_cache(uint16_t* indices, size_t indexCount, size_t vertexCount)
+{
+  optimize_vertex_cache_impl(indices, indexCount, vertexCount);
+}
+
+void optimize_vertex_cache(uint32_t* indices, size_t indexCount, size_t vertexCount)
+{
+  optimize_vertex_cache_impl(indices, indexCount, vertexCount);
+}
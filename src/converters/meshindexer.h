@@ -0,0 +1,36 @@
+// Copyright (C) 2025 Vincent Chambrin
+// This file is part of the 'mmd-viewer' project
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "rendering/psxobject3d.h"
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief turns the unindexed geometry of an object into indexed geometry
+ * @param object  the object
+ *
+ * On input, the vertices of the mesh are expected to be expanded (one
+ * vertex per corner of each primitive) and the primitives to reference
+ * ranges of 'vertices'.
+ *
+ * On output, identical vertices have been merged, the primitives are
+ * grouped into one range of 'indices' per material and primitive type,
+ * and triangles are reordered for the post-transform vertex cache.
+ * Meshes with more than 65536 vertices use 'wideIndices' instead.
+ */
+void index_mesh(PSX_Object3D& object);
+
+/**
+ * @brief reorders triangles to improve post-transform vertex cache hits
+ * @param indices      the triangle list, reordered in place
+ * @param indexCount   number of indices, a multiple of 3
+ * @param vertexCount  number of vertices referenced by the indices
+ *
+ * This implements Tom Forsyth's "Linear-Speed Vertex Cache Optimisation".
+ */
+void optimize_vertex_cache(uint16_t* indices, size_t indexCount, size_t vertexCount);
+void optimize_vertex_cache(uint32_t* indices, size_t indexCount, size_t vertexCount);
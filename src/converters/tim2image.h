@@ -11,36 +11,30 @@
 
 #include <vector>
 
-inline QImage tim2image(const TimImage::Image& src)
+/**
+ * @brief wraps decoded TIM pixels into a QImage
+ *
+ * The pixels are moved into a heap buffer that the QImage owns and frees,
+ * there is no per-pixel copy.
+ */
+inline QImage tim2image(TimImage::Image src)
 {
-  QImage qimg{QSize(src.width, src.height), QImage::Format_ARGB32};
-  for (int i(0); i < src.width; ++i)
+  if (src.pixelData.empty())
   {
-    for (int j(0); j < src.height; ++j)
-    {
-      qimg.setPixel(i, j, src.pixelData.at(j * src.width + i));
-    }
+    return QImage();
   }
-  return qimg;
-}
 
-inline std::vector<QImage> tim2images(const TimImage& src)
-{
-  std::vector<QImage> result;
+  auto* pixels = new std::vector<uint32_t>(std::move(src.pixelData));
 
-  if (src.usesPalette())
-  {
-    for (int i(0); i < src.numberOfPalettes(); ++i)
-    {
-      TimImage::Image imgdata = src.generateImage(i);
-      result.push_back(tim2image(imgdata));
-    }
-  }
-  else
-  {
-    TimImage::Image imgdata = src.generateImage();
-    result.push_back(tim2image(imgdata));
-  }
+  auto cleanup = [](void* info) {
+    delete static_cast<std::vector<uint32_t>*>(info);
+  };
 
-  return result;
+  return QImage(reinterpret_cast<uchar*>(pixels->data()),
+                src.width,
+                src.height,
+                src.width * sizeof(uint32_t),
+                QImage::Format_ARGB32,
+                cleanup,
+                pixels);
 }
@@ -9,11 +9,20 @@
 #include "formats/tim.h"
 #include "formats/tmd.h"
 
+#include "converters/meshindexer.h"
 #include "converters/tim2image.h"
 
+#include "jobsystem.h"
+
+#include <QDebug>
+#include <QMutex>
 #include <QVector3D>
 
+#include <algorithm>
+#include <array>
+#include <cmath>
 #include <map>
+#include <unordered_map>
 
 inline QVector3D convert(tmd_vertex_t vertex)
 {
@@ -33,36 +42,93 @@ inline RgbColor convert(tmd_color_t c)
   return RgbColor(c.r, c.g, c.b);
 }
 
+/**
+ * @brief packs a unit vector into a GL_INT_2_10_10_10_REV integer
+ */
+inline uint32_t pack_normal(const QVector3D& n)
+{
+  auto pack = [](float x) -> uint32_t {
+    const int i = static_cast<int>(std::round(std::clamp(x, -1.f, 1.f) * 511.f));
+    return static_cast<uint32_t>(i) & 0x3FF;
+  };
+
+  return pack(n.x()) | (pack(n.y()) << 10) | (pack(n.z()) << 20);
+}
+
 class PSX_TextureCache
 {
 private:
   std::vector<TimImage> m_tims;
 
-  struct SearchKey
-  {
-    int texturePage = -1;
-    int bpp = -1;
-    int clutY = -1;
-    auto operator<=>(const SearchKey&) const = default;
-  };
+  static constexpr int NUMBER_OF_TEXTURE_PAGES = 32;
+
+  // index in m_tims of the TIM covering each texture page, -1 if none
+  std::array<int, NUMBER_OF_TEXTURE_PAGES> m_page_table;
 
-  std::map<SearchKey, std::shared_ptr<PSX_Texture>> m_textures;
+  std::unordered_map<uint64_t, std::shared_ptr<PSX_Texture>> m_textures;
+  std::shared_ptr<PSX_Vram> m_vram;
 
 public:
+  PSX_TextureCache() { m_page_table.fill(-1); }
+
   const std::vector<TimImage>& tims() const { return m_tims; }
 
   void setTIMs(std::vector<TimImage> images)
   {
     m_tims = std::move(images);
     m_textures.clear();
+
+    // the last TIM of a page wins, as it would overwrite the others in VRAM
+    m_page_table.fill(-1);
+
+    for (size_t i(0); i < m_tims.size(); ++i)
+    {
+      const int page = getTexturePageFromVRAMCoords(m_tims[i]);
+
+      if (page >= 0 && page < NUMBER_OF_TEXTURE_PAGES)
+      {
+        m_page_table[page] = int(i);
+      }
+    }
+
+    if (m_vram)
+    {
+      loadVram();
+    }
+  }
+
+  /**
+   * @brief returns the emulated VRAM, or null if VRAM emulation is disabled
+   */
+  const std::shared_ptr<PSX_Vram>& vram() const { return m_vram; }
+
+  /**
+   * @brief enables or disables VRAM emulation
+   *
+   * When enabled, the TIMs are loaded into a single VRAM that is sampled
+   * by the materials instead of creating one texture per texture page
+   * and palette.
+   */
+  void setVramEmulation(bool enabled)
+  {
+    if (enabled == (m_vram != nullptr))
+    {
+      return;
+    }
+
+    if (enabled)
+    {
+      loadVram();
+    }
+    else
+    {
+      m_vram.reset();
+    }
   }
 
   std::shared_ptr<PSX_Texture> getTexture(int page, int bpp, int clutX, int clutY)
   {
-    SearchKey key;
-    key.texturePage = page;
-    key.bpp = bpp;
-    key.clutY = clutY;
+    const uint64_t key = packKey(page, bpp, clutX, clutY);
 
     auto it = m_textures.find(key);
     if (it != m_textures.end())
@@ -87,6 +153,29 @@ public:
   }
 
 private:
+  /**
+   * @brief packs the parameters of getTexture() into a hash map key
+   *
+   * Coordinates are stored as 16-bit values so that -1 ("use the TIM's
+   * palette") does not collide with a valid coordinate.
+   */
+  static uint64_t packKey(int page, int bpp, int clutX, int clutY)
+  {
+    return (uint64_t(uint8_t(page)) << 40) | (uint64_t(uint8_t(bpp)) << 32) | (uint64_t(uint16_t(clutX)) << 16)
+           | uint64_t(uint16_t(clutY));
+  }
+
+  void loadVram()
+  {
+    // TIMs are loaded in order so that the last one wins, as in the page table
+    m_vram = std::make_shared<PSX_Vram>();
+
+    for (const TimImage& tim : m_tims)
+    {
+      m_vram->vram.load(tim);
+    }
+  }
+
   static int getTexturePageFromVRAMCoords(const TimImage& img)
   {
     constexpr int VRAM_TEXTURE_PAGE_NATIVE_WIDTH = 64;
@@ -98,88 +187,156 @@ private:
 
   QImage createTextureImage(int texturePage, int clutX, int clutY)
   {
-    auto it = std::find_if(m_tims.rbegin(), m_tims.rend(), [texturePage](const TimImage& img) {
-      return getTexturePageFromVRAMCoords(img) == texturePage;
-    });
-
-    if (it == m_tims.rend())
+    if (texturePage < 0 || texturePage >= NUMBER_OF_TEXTURE_PAGES || m_page_table[texturePage] == -1)
     {
       return QImage();
     }
 
-    const TimImage& tim = *it;
-    TimImage::Image timimg = tim.generateImage(clutX, clutY);
-    return tim2image(timimg);
+    const TimImage& tim = m_tims[m_page_table[texturePage]];
+    return tim2image(tim.generateImage(clutX, clutY));
   }
 };
 
+struct PSX_MaterialKey
+{
+  int texturePage = -1;
+  int bpp = -1;
+  int clutX = -1;
+  int clutY = -1;
+  bool vram = false;
+  bool vertexColors = false;
+  bool light = false;
+  bool translucent = false;
+  int blendMode = 0;
+  int color = -1;
+
+  auto operator<=>(const PSX_MaterialKey&) const = default;
+};
+
+/**
+ * @brief the materials created by a TMD_ModelConverter
+ *
+ * Materials are shared by all the objects converted with the same
+ * converter, so that a model ends up with one material per distinct set
+ * of properties.
+ */
+using PSX_MaterialLibrary = std::map<PSX_MaterialKey, std::shared_ptr<PSX_Material>>;
+
+/**
+ * @brief returns the texture page and palette of a textured primitive
+ */
+inline PSX_TextureWindow texture_window(const TMD_Primitive& primitive)
+{
+  PSX_TextureWindow window;
+  window.texturePage = primitive.textureInfo().page;
+  window.bpp = get_textureinfo_bpp(primitive.textureInfo());
+  window.clutX = primitive.clutInfo().clutX * 16;
+  window.clutY = primitive.clutInfo().clutY;
+  return window;
+}
+
 class PSX_MaterialTracker
 {
 private:
   std::vector<std::shared_ptr<PSX_Material>>& m_materials;
-
-  struct SearchKey
-  {
-    int texturePage = -1;
-    int bpp = -1;
-    int clutY = -1;
-    bool vertexColors = false;
-    bool light = false;
-
-    auto operator<=>(const SearchKey&) const = default;
-  };
-
   PSX_TextureCache& m_textures;
-  std::map<SearchKey, int> m_materialsmap;
+  PSX_MaterialLibrary& m_library;
+  std::map<PSX_Material*, int> m_indices;
 
 public:
-  PSX_MaterialTracker(PSX_TextureCache& textures, std::vector<std::shared_ptr<PSX_Material>>& target)
+  PSX_MaterialTracker(PSX_TextureCache& textures,
+                      PSX_MaterialLibrary& library,
+                      std::vector<std::shared_ptr<PSX_Material>>& target)
       : m_materials(target)
       , m_textures(textures)
+      , m_library(library)
   {}
 
   int getMaterialIndex(const TMD_Primitive& primitive)
   {
-    SearchKey key;
+    std::shared_ptr<PSX_Material> material = getMaterial(primitive);
+
+    auto [it, inserted] = m_indices.try_emplace(material.get(), int(m_materials.size()));
+
+    if (inserted)
+    {
+      m_materials.push_back(material);
+    }
+
+    return it->second;
+  }
+
+private:
+  std::shared_ptr<PSX_Material> getMaterial(const TMD_Primitive& primitive)
+  {
+    PSX_MaterialKey key;
+    key.translucent = primitive.hasTranslucency();
+    key.blendMode = primitive.textureInfo().mixtureRate;
 
     if (primitive.hasTexture())
     {
+      key.light = primitive.normalCount() > 0;
+
+      // a VRAM addresses at most MAX_TEXTURE_WINDOWS windows,
+      // the primitives using other windows get a texture of their own
+      if (m_textures.vram() && m_textures.vram()->textureWindowIndex(texture_window(primitive)) != -1)
+      {
+        // the texture page and palette are stored in the vertices,
+        // see TMD_ModelConverter::getTextureWindow()
+        key.vram = true;
+
+        auto it = m_library.find(key);
+
+        if (it != m_library.end())
+        {
+          return it->second;
+        }
+
+        auto material = std::make_shared<PSX_Material>();
+        material->lighting = key.light;
+        material->translucent = key.translucent;
+        material->blendMode = key.blendMode;
+        material->vram = m_textures.vram();
+        return m_library[key] = material;
+      }
+
       key.bpp = get_textureinfo_bpp(primitive.textureInfo());
       key.texturePage = primitive.textureInfo().page;
+      key.clutX = primitive.clutInfo().clutX * 16;
       key.clutY = primitive.clutInfo().clutY;
-      key.light = primitive.normalCount() > 0;
 
-      auto it = m_materialsmap.find(key);
+      auto it = m_library.find(key);
 
-      if (it != m_materialsmap.end())
+      if (it != m_library.end())
       {
         return it->second;
       }
 
-      std::shared_ptr<PSX_Texture> texture = m_textures.getTexture(key.texturePage,
-                                                                   key.bpp,
-                                                                   primitive.clutInfo().clutX * 16,
-                                                                   key.clutY);
+      std::shared_ptr<PSX_Texture> texture = m_textures.getTexture(key.texturePage, key.bpp, key.clutX, key.clutY);
 
       if (texture)
       {
         auto material = std::make_shared<PSX_Material>();
         material->lighting = key.light;
+        material->translucent = key.translucent;
+        material->blendMode = key.blendMode;
         material->map = texture;
-
-        const int material_index = m_materials.size();
-        m_materials.push_back(material);
-        m_materialsmap[key] = material_index;
-        return material_index;
+        return m_library[key] = material;
       }
     }
 
     key.light = primitive.normalCount() > 0;
     key.vertexColors = primitive.colorCount() == primitive.vertexCount();
 
-    auto it = m_materialsmap.find(key);
+    if (primitive.colorCount() == 1)
+    {
+      const tmd_color_t c = *primitive.colors();
+      key.color = (c.r << 16) | (c.g << 8) | c.b;
+    }
+
+    auto it = m_library.find(key);
 
-    if (it != m_materialsmap.end())
+    if (it != m_library.end())
     {
       return it->second;
     }
@@ -187,6 +344,8 @@ public:
     auto material = std::make_shared<PSX_Material>();
     material->lighting = key.light;
     material->vertexColors = key.vertexColors;
+    material->translucent = key.translucent;
+    material->blendMode = key.blendMode;
 
     if (primitive.colorCount() == 1)
     {
@@ -197,70 +356,44 @@ public:
       material->color = RgbColor(127, 0, 127);
     }
 
-    const int material_index = m_materials.size();
-    m_materials.push_back(material);
-    m_materialsmap[key] = material_index;
-    return material_index;
+    return m_library[key] = material;
   }
 };
 
-class TMD_TexCoordsConverter
+/**
+ * @brief converts the objects of a TMD model into PSX_Object3D
+ *
+ * Objects can be converted from several threads at once; the materials
+ * and textures they share are created under a lock.
+ */
+class TMD_ModelConverter
 {
-public:
-  float m_width;
-  float m_height;
+private:
+  PSX_TextureCache m_textures;
+  PSX_MaterialLibrary m_materials;
+  QMutex m_mutex; ///< protects 'm_textures' and 'm_materials' during conversions
 
 public:
-  explicit TMD_TexCoordsConverter(const QImage& tex)
-      : m_width(tex.width())
-      , m_height(tex.height())
-  {}
+  PSX_TextureCache& textures() { return m_textures; }
 
-  explicit TMD_TexCoordsConverter(PSX_Texture* texture)
+  void setTIMs(std::vector<TimImage> images)
   {
-    if (texture)
-    {
-      m_width = texture->image.width();
-      m_height = texture->image.height();
-    }
-    else
-    {
-      constexpr int VRAM_ACCESSIBLE_TEXTURE_WIDTH =
-          256; // (texture page width) * 16bits / 4-bit per pixel
-      constexpr int VRAM_ACCESSIBLE_TEXTURE_HEIGHT = 256;
-
-      m_width = VRAM_ACCESSIBLE_TEXTURE_WIDTH;
-      m_height = VRAM_ACCESSIBLE_TEXTURE_HEIGHT;
-    }
+    textures().setTIMs(std::move(images));
+    m_materials.clear();
   }
 
-  TMD_TexCoordsConverter(float textureWidth, float textureHeight)
-      : m_width(textureWidth)
-      , m_height(textureHeight)
-  {}
-
-  QVector2D convert(tmd_uv_coord_t uv) const
+  void setVramEmulation(bool enabled)
   {
-    return QVector2D(uv.u / m_width + 0.0001f, (m_height - uv.v) / m_height + 0.0001f);
+    textures().setVramEmulation(enabled);
+    m_materials.clear();
   }
-};
-
-class TMD_ModelConverter
-{
-private:
-  PSX_TextureCache m_textures;
-
-public:
-  PSX_TextureCache& textures() { return m_textures; }
-  void setTIMs(std::vector<TimImage> images) { textures().setTIMs(std::move(images)); }
 
   std::unique_ptr<Group> convertModel(const TMD_Model& model)
   {
     auto group = std::make_unique<Group>();
 
-    for (const TMD_Object& obj : model.objects())
+    for (std::unique_ptr<Object3D>& obj3d : convertObjects(model.objects()))
     {
-      std::unique_ptr<Object3D> obj3d = convertObject(obj);
       if (obj3d)
       {
         group->add(std::move(obj3d));
@@ -270,6 +403,39 @@ public:
     return group;
   }
 
+  /**
+   * @brief converts objects in parallel on the JobSystem
+   *
+   * The result has one entry per object, in the same order, null for
+   * objects without primitives.
+   */
+  std::vector<std::unique_ptr<Object3D>> convertObjects(const std::vector<const TMD_Object*>& objects)
+  {
+    std::vector<std::unique_ptr<Object3D>> result(objects.size());
+
+    JobSystem::instance().parallelFor(objects.size(), 1, [this, &objects, &result](size_t begin, size_t end) {
+      for (size_t i(begin); i < end; ++i)
+      {
+        result[i] = objects[i] ? convertObject(*objects[i]) : nullptr;
+      }
+    });
+
+    return result;
+  }
+
+  std::vector<std::unique_ptr<Object3D>> convertObjects(const std::vector<TMD_Object>& objects)
+  {
+    std::vector<const TMD_Object*> pointers;
+    pointers.reserve(objects.size());
+
+    for (const TMD_Object& object : objects)
+    {
+      pointers.push_back(&object);
+    }
+
+    return convertObjects(pointers);
+  }
+
   std::unique_ptr<Object3D> convertObject(const TMD_Object& object)
   {
     const TMD_PrimitiveList& primitives = object.primitives();
@@ -282,7 +448,7 @@ public:
     auto result = std::make_unique<PSX_Object3D>();
     result->primitives.reserve(primitives.count());
 
-    PSX_MaterialTracker tracker{m_textures, result->materials};
+    PSX_MaterialTracker tracker{m_textures, m_materials, result->materials};
 
     for (int i(0); i < primitives.count(); ++i)
     {
@@ -294,10 +460,23 @@ public:
       }
     }
 
+    index_mesh(*result);
+
+    for (const PSX_Vertex& v : result->mesh->vertices)
+    {
+      result->mesh->bounds.extend(QVector3D(v.position[0], v.position[1], v.position[2]));
+    }
+
     return result;
   }
 
 private:
+  int getMaterialIndex(PSX_MaterialTracker& materialTracker, const TMD_Primitive& primitive)
+  {
+    QMutexLocker lock{&m_mutex};
+    return materialTracker.getMaterialIndex(primitive);
+  }
+
   bool addPrimitive(PSX_Object3D& data,
                     PSX_MaterialTracker& materialTracker,
                     const TMD_Object& tmdObj,
@@ -308,16 +487,14 @@ private:
     if (primitive.getCode() == TMD_Code_POLYGON)
     {
       element.type = primitive.vertexCount() == 4 ? PSX_Object3D::Quad : PSX_Object3D::Triangle;
-      element.index = data.vertices.size();
+      element.index = data.mesh->vertices.size();
       element.count = element.type == PSX_Object3D::Quad ? 6 : 3;
 
-      element.materialIndex = materialTracker.getMaterialIndex(primitive);
+      element.materialIndex = getMaterialIndex(materialTracker, primitive);
 
       assert(primitive.colorCount() > 0 || primitive.hasTexture());
 
-      TMD_TexCoordsConverter uvconv{data.materials[element.materialIndex]->map.get()};
-
-      append_triangles(data, tmdObj, primitive, uvconv);
+      append_triangles(*data.mesh, tmdObj, primitive);
 
       data.primitives.push_back(element);
 
@@ -326,16 +503,14 @@ private:
     else if (primitive.getCode() == TMD_Code_LINE)
     {
       element.type = PSX_Object3D::Line;
-      element.index = data.vertices.size();
+      element.index = data.mesh->vertices.size();
       element.count = 2;
 
-      element.materialIndex = materialTracker.getMaterialIndex(primitive);
+      element.materialIndex = getMaterialIndex(materialTracker, primitive);
 
       assert(primitive.colorCount() > 0 || primitive.hasTexture());
 
-      TMD_TexCoordsConverter uvconv{data.materials[element.materialIndex]->map.get()};
-
-      append_line(data, tmdObj, primitive, uvconv);
+      append_line(*data.mesh, tmdObj, primitive);
 
       data.primitives.push_back(element);
 
@@ -349,208 +524,96 @@ private:
     return false;
   }
 
-  void append_triangles(PSX_Object3D& data,
-                        const TMD_Object& tmdObj,
-                        const TMD_Primitive& primitive,
-                        TMD_TexCoordsConverter& uvconv)
+  void append_triangles(PSX_Mesh& data, const TMD_Object& tmdObj, const TMD_Primitive& primitive)
   {
-    const QVector3D default_normal = QVector3D(-1, -1, -1).normalized();
-    const QVector2D default_uv = QVector2D(0, 0);
-    const RgbColor default_color = RgbColor(127, 127, 127);
+    // quads are split into two triangles
+    constexpr int corners[] = {2, 1, 0, 1, 2, 3};
+    const int count = primitive.vertexCount() == 4 ? 6 : 3;
 
-    const size_t offset = data.vertices.size();
+    data.hasNormals |= primitive.normalCount() > 0;
+    data.hasColors |= primitive.colorCount() > 0;
+    data.hasUV |= primitive.hasTexture();
 
-    constexpr int i00 = 2;
-    constexpr int i01 = 1;
-    constexpr int i02 = 0;
-    constexpr int i10 = 1;
-    constexpr int i11 = 2;
-    constexpr int i12 = 3;
+    const uint8_t window_index = getTextureWindow(primitive);
 
-    if (offset > 0)
+    for (int i(0); i < count; ++i)
     {
-      // fill attributes with dummy elements if neeeded
-      {
-        if (primitive.normalCount() > 0 && data.normals.empty())
-        {
-          data.normals.resize(offset, default_normal);
-        }
-
-        if (primitive.colorCount() > 0 && data.colors.empty())
-        {
-          data.colors.resize(offset, default_color);
-        }
-
-        if (primitive.hasTexture() && data.uv.empty())
-        {
-          data.uv.resize(offset, default_uv);
-        }
-      }
-
-      const size_t newvertex_count = offset + (primitive.vertexCount() == 4 ? 6 : 3);
-      {
-        if (!data.normals.empty() && primitive.normalCount() == 0)
-        {
-          data.normals.resize(newvertex_count, default_normal);
-        }
-
-        if (primitive.colorCount() == 0 && !data.colors.empty())
-        {
-          data.colors.resize(newvertex_count, default_color);
-        }
-
-        if (!primitive.hasTexture() && !data.uv.empty())
-        {
-          data.uv.resize(newvertex_count, default_uv);
-        }
-      }
-    }
-
-    if (primitive.normalCount() > 0)
-    {
-      const tmd_normal_t* normals = tmdObj.normals().data();
-      const uint16_t* indices = primitive.normals();
-      const size_t last_index = primitive.normalCount() - 1;
-      data.normals.push_back(convert(normals[indices[std::min<size_t>(i00, last_index)]]));
-      data.normals.push_back(convert(normals[indices[std::min<size_t>(i01, last_index)]]));
-      data.normals.push_back(convert(normals[indices[std::min<size_t>(i02, last_index)]]));
+      PSX_Vertex v = make_vertex(tmdObj, primitive, corners[i]);
+      v.textureWindow = window_index;
+      data.vertices.push_back(v);
     }
+  }
 
-    // vertices
-    {
-      const tmd_vertex_t* vertices = tmdObj.vertices().data();
-      const uint16_t* indices = primitive.vertexBuf();
-      data.vertices.push_back(convert(vertices[indices[i00]]));
-      data.vertices.push_back(convert(vertices[indices[i01]]));
-      data.vertices.push_back(convert(vertices[indices[i02]]));
-    }
+  /**
+   * @brief returns the index of the texture window of a primitive in the emulated VRAM
+   */
+  uint8_t getTextureWindow(const TMD_Primitive& primitive)
+  {
+    const std::shared_ptr<PSX_Vram>& vram = m_textures.vram();
 
-    if (primitive.colorCount() > 0)
+    if (!vram || !primitive.hasTexture())
     {
-      const tmd_color_t* colors = primitive.colors();
-      const size_t last_index = primitive.colorCount() - 1;
-      data.colors.push_back(convert(colors[std::min<size_t>(i00, last_index)]));
-      data.colors.push_back(convert(colors[std::min<size_t>(i01, last_index)]));
-      data.colors.push_back(convert(colors[std::min<size_t>(i02, last_index)]));
+      return 0;
     }
 
-    if (primitive.hasTexture())
+    int index;
     {
-      const tmd_uv_coord_t* uvs = primitive.uvs();
-
-      data.uv.push_back(uvconv.convert(uvs[i00]));
-      data.uv.push_back(uvconv.convert(uvs[i01]));
-      data.uv.push_back(uvconv.convert(uvs[i02]));
+      QMutexLocker lock{&m_mutex};
+      index = vram->textureWindowIndex(texture_window(primitive));
     }
 
-    if (primitive.vertexCount() == 4)
-    {
-      if (primitive.normalCount() > 0)
-      {
-        const tmd_normal_t* normals = tmdObj.normals().data();
-        const uint16_t* indices = primitive.normals();
-        const size_t last_index = primitive.normalCount() - 1;
-        data.normals.push_back(convert(normals[indices[std::min<size_t>(i10, last_index)]]));
-        data.normals.push_back(convert(normals[indices[std::min<size_t>(i11, last_index)]]));
-        data.normals.push_back(convert(normals[indices[std::min<size_t>(i12, last_index)]]));
-      }
-
-      // vertices
-      {
-        const tmd_vertex_t* vertices = tmdObj.vertices().data();
-        const uint16_t* indices = primitive.vertexBuf();
-        data.vertices.push_back(convert(vertices[indices[i10]]));
-        data.vertices.push_back(convert(vertices[indices[i11]]));
-        data.vertices.push_back(convert(vertices[indices[i12]]));
-      }
+    // -1 if the VRAM was full, the primitive then has a texture material
+    // that ignores the window, see PSX_MaterialTracker::getMaterial()
+    return index == -1 ? 0 : uint8_t(index);
+  }
 
-      if (primitive.colorCount() > 0)
-      {
-        const tmd_color_t* colors = primitive.colors();
-        const size_t last_index = primitive.colorCount() - 1;
-        data.colors.push_back(convert(colors[std::min<size_t>(i10, last_index)]));
-        data.colors.push_back(convert(colors[std::min<size_t>(i11, last_index)]));
-        data.colors.push_back(convert(colors[std::min<size_t>(i12, last_index)]));
-      }
+  void append_line(PSX_Mesh& data, const TMD_Object& tmdObj, const TMD_Primitive& primitive)
+  {
+    assert(primitive.normalCount() == 0);
+    assert(!primitive.hasTexture());
+    assert(primitive.colorCount() > 0);
 
-      if (primitive.hasTexture())
-      {
-        const tmd_uv_coord_t* uvs = primitive.uvs();
+    data.hasColors = true;
 
-        data.uv.push_back(uvconv.convert(uvs[i10]));
-        data.uv.push_back(uvconv.convert(uvs[i11]));
-        data.uv.push_back(uvconv.convert(uvs[i12]));
-      }
-    }
+    data.vertices.push_back(make_vertex(tmdObj, primitive, 0));
+    data.vertices.push_back(make_vertex(tmdObj, primitive, 1));
   }
 
-  void append_line(PSX_Object3D& data,
-                   const TMD_Object& tmdObj,
-                   const TMD_Primitive& primitive,
-                   TMD_TexCoordsConverter& uvconv)
+  PSX_Vertex make_vertex(const TMD_Object& tmdObj, const TMD_Primitive& primitive, int corner)
   {
-    const QVector3D default_normal = QVector3D(-1, -1, -1).normalized();
-    const QVector2D default_uv = QVector2D(0, 0);
-    const RgbColor default_color = RgbColor(127, 127, 127);
-
-    const size_t offset = data.vertices.size();
+    // attributes that the primitive does not have keep a default value,
+    // in case other primitives of the mesh have them.
+    PSX_Vertex v;
+    v.uv[0] = 0;
+    v.uv[1] = 0;
+    v.normal = pack_normal(QVector3D(-1, -1, -1).normalized());
+    v.color = RgbColor(127, 127, 127);
+
+    const tmd_vertex_t& position = tmdObj.vertices()[primitive.vertexBuf()[corner]];
+    v.position[0] = position.x;
+    v.position[1] = position.y;
+    v.position[2] = position.z;
 
-    if (offset > 0)
+    if (primitive.normalCount() > 0)
     {
-      // fill attributes with dummy elements if neeeded
-      {
-        if (primitive.normalCount() > 0 && data.normals.empty())
-        {
-          data.normals.resize(offset, default_normal);
-        }
-
-        if (primitive.colorCount() > 0 && data.colors.empty())
-        {
-          data.colors.resize(offset, default_color);
-        }
-
-        if (primitive.hasTexture() && data.uv.empty())
-        {
-          data.uv.resize(offset, default_uv);
-        }
-      }
-
-      const size_t newvertex_count = offset + 2;
-      {
-        if (!data.normals.empty() && primitive.normalCount() == 0)
-        {
-          data.normals.resize(newvertex_count, default_normal);
-        }
-
-        if (primitive.colorCount() == 0 && !data.colors.empty())
-        {
-          data.colors.resize(newvertex_count, default_color);
-        }
-
-        if (!primitive.hasTexture() && !data.uv.empty())
-        {
-          data.uv.resize(newvertex_count, default_uv);
-        }
-      }
+      const size_t last_index = primitive.normalCount() - 1;
+      const uint16_t index = primitive.normals()[std::min<size_t>(corner, last_index)];
+      v.normal = pack_normal(convert(tmdObj.normals()[index]));
     }
 
-    assert(primitive.normalCount() == 0);
-    assert(!primitive.hasTexture());
-
-    // vertices
+    if (primitive.colorCount() > 0)
     {
-      const tmd_vertex_t* vertices = tmdObj.vertices().data();
-      const uint16_t* indices = primitive.vertexBuf();
-      data.vertices.push_back(convert(vertices[indices[0]]));
-      data.vertices.push_back(convert(vertices[indices[1]]));
+      const size_t last_index = primitive.colorCount() - 1;
+      v.color = convert(primitive.colors()[std::min<size_t>(corner, last_index)]);
     }
 
-    assert(primitive.colorCount() > 0);
+    if (primitive.hasTexture())
     {
-      const tmd_color_t* colors = primitive.colors();
-      const size_t last_index = primitive.colorCount() - 1;
-      data.colors.push_back(convert(colors[std::min<size_t>(0, last_index)]));
-      data.colors.push_back(convert(colors[std::min<size_t>(1, last_index)]));
+      const tmd_uv_coord_t uv = primitive.uvs()[corner];
+      v.uv[0] = uv.u;
+      v.uv[1] = uv.v;
     }
+
+    return v;
   }
 };
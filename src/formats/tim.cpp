@@ -6,47 +6,22 @@
 
 #include "datastream.h"
 
+#include "psx/psxcolor.h"
+
+#include <array>
 #include <cassert>
-#include <cmath>
 #include <fstream>
 
-inline unsigned long colorFromPsx24bit(u32 c)
-{
-  constexpr unsigned long mask = 0xff;
-  unsigned long red = c & mask;
-  unsigned long green = (c >> 8) & mask;
-  unsigned long blue = (c >> 8) & mask;
-  return (0xffu << 24) | (red << 16) | (green << 8) | (blue);
-}
-
-unsigned long colorFromPsx16bit(u16 c)
+uint32_t colorFromPsx16bit(u16 c)
 {
-  constexpr unsigned long mask = 0b11111u;
-  unsigned long red = c & mask;
-  unsigned long green = (c >> 5) & mask;
-  unsigned long blue = (c >> 10) & mask;
-  const bool stpbit = (c >> 15); // special transparency processing bit
-
-  red = (unsigned long) std::round((red * 255) / double(mask));
-  green = (unsigned long) std::round((green * 255) / double(mask));
-  blue = (unsigned long) std::round((blue * 255) / double(mask));
-
-  unsigned long alpha = stpbit ? 0 : 255;
-
-  // rgb(0,0,0) is transparent by default, unless the stp bit is set
-  if (red == 0 && green == 0 && blue == 0)
-  {
-    alpha = 255 - alpha;
-  }
-
-  return (alpha << 24) | (red << 16) | (green << 8) | (blue);
+  return psx16_to_argb(c);
 }
 
 void TimImageColorPalettes::fill(std::vector<TimImageColorPalette::Color>&& colors, int nbPalettes)
 {
   m_colors = std::move(colors);
   m_number_of_palettes = nbPalettes;
-  m_number_of_colors = m_colors.size() / m_number_of_palettes;
+  m_number_of_colors = nbPalettes > 0 ? m_colors.size() / m_number_of_palettes : 0;
 }
 
 u16 TimImageColorPalettes::x() const
@@ -95,6 +70,11 @@ int TimImage::height() const
   return m_imdata.height;
 }
 
+int TimImage::bpp() const
+{
+  return m_type.bpp();
+}
+
 bool TimImage::load(const std::filesystem::path& filePath)
 {
   TimReader reader;
@@ -129,40 +109,23 @@ TimImage::Image TimImage::generateImage() const
   {
     result.width = width();
     result.height = height();
-    result.pixelData.reserve(result.width * result.height);
-    for (u16 p : m_imdata.data)
-    {
-      result.pixelData.push_back(colorFromPsx16bit(p));
-    }
+    result.pixelData.resize(m_imdata.data.size());
+    psx16_to_argb(m_imdata.data.data(), result.pixelData.data(), m_imdata.data.size());
     return result;
   }
   else if (m_type.bpp() == 24)
   {
     result.width = width();
     result.height = height();
-    result.pixelData.reserve(result.width * result.height);
-    const u16* data = m_imdata.data.data();
-    size_t i = 0;
-    const size_t n = result.width * result.width;
+    result.pixelData.resize(size_t(result.width) * result.height);
 
-    constexpr u32 mask = 0xffu;
+    // rows are made of whole 16-bit words, and may end with a padding byte
+    const auto* data = reinterpret_cast<const u8*>(m_imdata.data.data());
+    const size_t stride = size_t(m_imdata.width) * sizeof(u16);
 
-    while (result.pixelData.size() < n)
+    for (int y(0); y < result.height; ++y)
     {
-      u32 c = 0;
-
-      if (i % 2 == 0)
-      {
-        c = data[i++];
-        c |= (data[i] & mask) << 16;
-      }
-      else
-      {
-        c = data[i++] >> 8;
-        c |= data[i++] << 8;
-      }
-
-      result.pixelData.push_back(colorFromPsx24bit(c));
+      psx24_to_argb(data + y * stride, result.pixelData.data() + y * result.width, result.width);
     }
 
     return result;
@@ -207,48 +170,54 @@ TimImage::Image TimImage::generateImage(int clutX, int clutY) const
 
 TimImage::Image TimImage::generateImageFromPalette(int paletteIndex, int offset) const
 {
-  const Palette& p = m_palettes.palette(paletteIndex);
+  const int bpp = m_type.bpp();
 
-  Image result{};
-  result.width = width();
-  result.height = height();
-  const size_t n = result.width * result.height;
-  result.pixelData.reserve(n);
+  if (bpp != 4 && bpp != 8)
+  {
+    return {};
+  }
 
-  const u16* data = m_imdata.data.data();
-  size_t i = 0;
+  const size_t clut_size = size_t(1) << bpp;
+  std::span<const Palette::Color> colors = m_palettes.paletteColors(paletteIndex);
+  const Palette::Color* clut = nullptr;
 
-  if (m_type.bpp() == 4)
+  // colors outside of the palette are transparent
+  std::array<Palette::Color, 256> padded_clut;
+
+  if (offset >= 0 && size_t(offset) + clut_size <= colors.size())
   {
-    constexpr u16 mask = 0xf;
-    while (result.pixelData.size() < n)
-    {
-      u16 indices = data[i++];
-      u16 i1 = (indices >> 0) & mask;
-      u16 i2 = (indices >> 4) & mask;
-      u16 i3 = (indices >> 8) & mask;
-      u16 i4 = (indices >> 12) & mask;
-      result.pixelData.push_back(p.at(offset + i1));
-      result.pixelData.push_back(p.at(offset + i2));
-      result.pixelData.push_back(p.at(offset + i3));
-      result.pixelData.push_back(p.at(offset + i4));
-    }
+    clut = colors.data() + offset;
   }
-  else if (m_type.bpp() == 8)
+  else
   {
-    constexpr u16 mask = 0xff;
-    while (result.pixelData.size() < n)
+    padded_clut.fill(0);
+
+    for (size_t i(0); i < clut_size; ++i)
     {
-      u16 indices = data[i++];
-      u16 i1 = indices & mask;
-      u16 i2 = indices >> 8;
-      result.pixelData.push_back(p.at(offset + i1));
-      result.pixelData.push_back(p.at(offset + i2));
+      const ptrdiff_t j = ptrdiff_t(offset) + ptrdiff_t(i);
+
+      if (j >= 0 && size_t(j) < colors.size())
+      {
+        padded_clut[i] = colors[j];
+      }
     }
+
+    clut = padded_clut.data();
+  }
+
+  Image result{};
+  result.width = width();
+  result.height = height();
+  const size_t n = size_t(result.width) * result.height;
+  result.pixelData.resize(n);
+
+  if (bpp == 4)
+  {
+    expand_clut4(m_imdata.data.data(), clut, result.pixelData.data(), n);
   }
   else
   {
-    return {};
+    expand_clut8(m_imdata.data.data(), clut, result.pixelData.data(), n);
   }
 
   return result;
@@ -277,7 +246,7 @@ bool TimReader::readTim(std::ifstream& stream, TimImage& outputImage)
 
   if (outputImage.m_type.clut())
   {
-    if (!(outputImage.m_type.bpp() == 4 || outputImage.m_type.bpp() == 4))
+    if (!(outputImage.m_type.bpp() == 4 || outputImage.m_type.bpp() == 8))
     {
       return false;
     }
@@ -299,14 +268,11 @@ bool TimReader::readTim(std::ifstream& stream, TimImage& outputImage)
     const u16 clut_height = read<u16>(stream);
     const size_t n = clut_width * clut_height;
     assert(clut_width * clut_height * 2 == clut_length - 3 * 4);
-    std::vector<TimImageColorPalette::Color> colors;
-    colors.reserve(n);
-    while (colors.size() < n)
-    {
-      const u16 c = read<u16>(stream);
-      colors.push_back(colorFromPsx16bit(c));
-    }
+    std::vector<u16> raw_colors = readvec<u16>(stream, n);
+    std::vector<TimImageColorPalette::Color> colors(raw_colors.size());
+    psx16_to_argb(raw_colors.data(), colors.data(), raw_colors.size());
     outputImage.m_palettes.fill(std::move(colors), clut_height);
+    outputImage.m_palettes.setRawColors(std::move(raw_colors));
     outputImage.m_palettes.setVramCoordinates(clut_x, clut_y);
   }
   else
@@ -371,7 +337,7 @@ bool TimReader::readTim(Buffer& buffer, TimImage& outputImage)
 
   if (outputImage.m_type.clut())
   {
-    if (!(outputImage.m_type.bpp() == 4 || outputImage.m_type.bpp() == 4))
+    if (!(outputImage.m_type.bpp() == 4 || outputImage.m_type.bpp() == 8))
     {
       return false;
     }
@@ -393,14 +359,12 @@ bool TimReader::readTim(Buffer& buffer, TimImage& outputImage)
     const u16 clut_height = readbuf<u16>(buffer);
     const size_t n = clut_width * clut_height;
     assert(clut_width * clut_height * 2 == clut_length - 3 * 4);
-    std::vector<TimImageColorPalette::Color> colors;
-    colors.reserve(n);
-    while (colors.size() < n)
-    {
-      const u16 c = readbuf<u16>(buffer);
-      colors.push_back(colorFromPsx16bit(c));
-    }
+    std::vector<u16> raw_colors(n);
+    buffer.read(reinterpret_cast<uint8_t*>(raw_colors.data()), n * sizeof(u16));
+    std::vector<TimImageColorPalette::Color> colors(n);
+    psx16_to_argb(raw_colors.data(), colors.data(), n);
     outputImage.m_palettes.fill(std::move(colors), clut_height);
+    outputImage.m_palettes.setRawColors(std::move(raw_colors));
     outputImage.m_palettes.setVramCoordinates(clut_x, clut_y);
   }
   else
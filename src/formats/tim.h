@@ -10,20 +10,21 @@
 #include "buffer.h"
 
 #include <filesystem>
+#include <span>
 #include <vector>
 
 // http://fileformats.archiveteam.org/wiki/TIM_(PlayStation_graphics)
 // https://www.psxdev.net/forum/viewtopic.php?t=109
 
 // convert color from psx A1B5G5R5 16-bit color
-unsigned long colorFromPsx16bit(u16 c);
+uint32_t colorFromPsx16bit(u16 c);
 
 class TimImageColorPalette
 {
 public:
   TimImageColorPalette() = default;
 
-  using Color = unsigned long; // 32-bit ARGB format (0xAARRGGBB)
+  using Color = uint32_t; // 32-bit ARGB format (0xAARRGGBB)
 
   explicit TimImageColorPalette(std::vector<Color>&& colors)
       : m_colors(std::move(colors))
@@ -60,9 +61,13 @@ public:
   int numberOfColorsPerPalette() const;
   std::vector<TimImageColorPalette> palettes() const;
   TimImageColorPalette palette(int i) const;
+  std::span<const TimImageColorPalette::Color> paletteColors(int i) const;
 
   void fill(std::vector<TimImageColorPalette::Color>&& colors, int nbPalettes);
 
+  const std::vector<u16>& rawColors() const;
+  void setRawColors(std::vector<u16> colors);
+
   u16 x() const;
   u16 y() const;
   void setVramCoordinates(u16 x, u16 y);
@@ -71,6 +76,7 @@ private:
   u16 m_number_of_colors = 0;
   u16 m_number_of_palettes = 0;
   std::vector<TimImageColorPalette::Color> m_colors;
+  std::vector<u16> m_raw_colors; // A1B5G5R5, as stored in VRAM
   u16 m_x = 0;
   u16 m_y = 0;
 };
@@ -85,6 +91,16 @@ inline int TimImageColorPalettes::numberOfColorsPerPalette() const
   return (int) m_number_of_colors;
 }
 
+inline const std::vector<u16>& TimImageColorPalettes::rawColors() const
+{
+  return m_raw_colors;
+}
+
+inline void TimImageColorPalettes::setRawColors(std::vector<u16> colors)
+{
+  m_raw_colors = std::move(colors);
+}
+
 inline std::vector<TimImageColorPalette> TimImageColorPalettes::palettes() const
 {
   std::vector<TimImageColorPalette> result;
@@ -100,10 +116,24 @@ inline std::vector<TimImageColorPalette> TimImageColorPalettes::palettes() const
 
 inline TimImageColorPalette TimImageColorPalettes::palette(int i) const
 {
-  auto colors = std::vector<TimImageColorPalette::Color>(m_colors.begin() + i * m_number_of_colors,
-                                                         m_colors.begin()
-                                                             + (i + 1) * m_number_of_colors);
-  return TimImageColorPalette(std::move(colors));
+  std::span<const TimImageColorPalette::Color> colors = paletteColors(i);
+  return TimImageColorPalette(std::vector<TimImageColorPalette::Color>(colors.begin(), colors.end()));
+}
+
+/**
+ * @brief returns the colors of the i-th palette, without copying them
+ *
+ * The span is empty if @a i is not a valid palette index.
+ */
+inline std::span<const TimImageColorPalette::Color> TimImageColorPalettes::paletteColors(int i) const
+{
+  if (i < 0 || i >= numberOfPalettes())
+  {
+    return {};
+  }
+
+  return std::span<const TimImageColorPalette::Color>(m_colors).subspan(size_t(i) * m_number_of_colors,
+                                                                         m_number_of_colors);
 }
 
 class TimImage
@@ -117,13 +147,14 @@ public:
   {
     int width;
     int height;
-    std::vector<unsigned long> pixelData;
+    std::vector<uint32_t> pixelData; // 32-bit ARGB format (0xAARRGGBB)
   };
 
   bool isNull() const;
 
   int width() const;
   int height() const;
+  int bpp() const;
 
   bool load(const std::filesystem::path& filePath);
 
@@ -136,6 +167,7 @@ public:
   uint32_t getPixelX() const { return m_imdata.x; }
   uint32_t getPixelY() const { return m_imdata.y; }
   const std::vector<u16>& pixelData() const { return m_imdata.data; }
+  int pixelDataWidth() const { return m_imdata.width; } ///< width of pixelData(), in 16-bit words
 
   Image generateImage() const;
   Image generateImage(int paletteIndex) const;
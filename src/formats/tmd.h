@@ -324,6 +324,8 @@ public:
            && reinterpret_cast<const TMD_ModeBitfield*>(&m_mode)->hasTexture;
   }
 
+  bool hasTranslucency() const { return reinterpret_cast<const TMD_ModeBitfield*>(&m_mode)->hasTranslucency; }
+
   TMD_TextureInfo textureInfo() const { return m_textureInfo; }
   TMD_CLUT_Info clutInfo() const { return m_clutInfo; }
 
@@ -14,6 +14,7 @@
 #include "formats/tim.h"
 
 #include "buffer.h"
+#include "jobsystem.h"
 #include "readfile.h"
 
 class GameReader
@@ -38,34 +39,37 @@ public:
     this->result.sourceDir = std::filesystem::path(filepath.toStdString()).parent_path();
     auto alltims = read_all(this->result.sourceDir / ALLTIM_PATH);
     constexpr size_t ALL_TIMS_STRIDE = 0x4800;
-    Buffer tims{alltims.data(), alltims.size()};
-
-    this->result.characters.clear();
 
     using DigimonFileName = char[8];
     DigimonFileName* names = reinterpret_cast<DigimonFileName*>(bytes.data() + gameinfo.nameOffset);
     CharacterInfo* info = reinterpret_cast<CharacterInfo*>(bytes.data()
                                                            + gameinfo.characterDataOffset);
     uint32_t* skelOffset = reinterpret_cast<uint32_t*>(bytes.data() + gameinfo.skelOffset);
+    char* data = bytes.data(); // not called from the jobs, which could make it detach
 
     constexpr int DIGIMON_COUNT = 180;
-    for (int i(0); i < DIGIMON_COUNT; ++i)
-    {
-      SkeletonNodeRel* skeletonOffset = reinterpret_cast<SkeletonNodeRel*>(
-          bytes.data() + skelOffset[i] - 0x80090000);
-      int32_t boneCount = info[i].boneCount;
+    this->result.characters.clear();
+    this->result.characters.resize(DIGIMON_COUNT);
 
-      CharacterEntry entry;
-      entry.index = i;
-      entry.filename = std::string(names[i]);
+    // entries are independent, the decoding of their TIM dominates
+    JobSystem::instance().parallelFor(DIGIMON_COUNT, 16, [&](size_t begin, size_t end) {
+      Buffer tims{alltims.data(), alltims.size()};
 
-      for (int32_t j = 0; j < boneCount; j++)
-        entry.skeleton.push_back(skeletonOffset[j]);
+      for (size_t i(begin); i < end; ++i)
+      {
+        SkeletonNodeRel* skeletonOffset = reinterpret_cast<SkeletonNodeRel*>(data + skelOffset[i] - 0x80090000);
+        int32_t boneCount = info[i].boneCount;
 
-      tims.seek(i * ALL_TIMS_STRIDE);
-      entry.texture = TimImage(&tims);
+        CharacterEntry& entry = this->result.characters[i];
+        entry.index = int(i);
+        entry.filename = std::string(names[i]);
 
-      this->result.characters.push_back(entry);
-    }
+        for (int32_t j = 0; j < boneCount; j++)
+          entry.skeleton.push_back(skeletonOffset[j]);
+
+        tims.seek(i * ALL_TIMS_STRIDE);
+        entry.texture = TimImage(&tims);
+      }
+    });
   }
 };
@@ -0,0 +1,411 @@
+// Copyright (C) 2025 Vincent Chambrin
+// This file is part of the 'mmd-viewer' project
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "jobsystem.h"
+
+#include <QCoreApplication>
+
+#include <algorithm>
+
+// the job system and worker index of the current thread, -1 if it is not a worker
+thread_local JobSystem* t_job_system = nullptr;
+thread_local int t_worker_index = -1;
+
+Job::Job(std::function<void()> function)
+    : m_function(std::move(function))
+{}
+
+class JobSystem::Worker : public QThread
+{
+public:
+  Worker(JobSystem& system, int index)
+      : m_system(system)
+      , m_index(index)
+  {
+    setObjectName(QString("JobSystem worker %1").arg(index));
+  }
+
+protected:
+  void run() override
+  {
+    t_job_system = &m_system;
+    t_worker_index = m_index;
+    m_system.workerLoop(m_index);
+  }
+
+private:
+  JobSystem& m_system;
+  int m_index;
+};
+
+JobSystem::JobSystem()
+    : JobSystem(std::max(QThread::idealThreadCount() - 1, 1))
+{}
+
+JobSystem::JobSystem(int workerCount)
+{
+  workerCount = std::max(workerCount, 1);
+
+  for (int i(0); i < workerCount; ++i)
+  {
+    m_queues.push_back(std::make_unique<Queue>());
+  }
+
+  for (int i(0); i < workerCount; ++i)
+  {
+    m_workers.push_back(std::make_unique<Worker>(*this, i));
+    m_workers.back()->start();
+  }
+}
+
+JobSystem::~JobSystem()
+{
+  {
+    QMutexLocker lock{&m_sleep_mutex};
+    m_quit = true;
+  }
+
+  m_wake.wakeAll();
+
+  for (std::unique_ptr<Worker>& worker : m_workers)
+  {
+    worker->wait();
+  }
+}
+
+JobSystem& JobSystem::instance()
+{
+  static JobSystem system;
+  return system;
+}
+
+int JobSystem::workerCount() const
+{
+  return int(m_workers.size());
+}
+
+JobPtr JobSystem::submit(std::function<void()> function, std::initializer_list<JobPtr> dependencies)
+{
+  return submit(std::move(function), std::vector<JobPtr>(dependencies));
+}
+
+JobPtr JobSystem::submit(std::function<void()> function, const std::vector<JobPtr>& dependencies)
+{
+  auto job = std::make_shared<Job>(std::move(function));
+  job->m_pending_dependencies.fetch_add(int(dependencies.size()), std::memory_order_relaxed);
+
+  for (const JobPtr& dependency : dependencies)
+  {
+    bool finished = !dependency;
+
+    if (dependency)
+    {
+      QMutexLocker lock{&dependency->m_mutex};
+      finished = dependency->finished();
+
+      if (!finished)
+      {
+        dependency->m_dependents.push_back(job);
+      }
+    }
+
+    if (finished)
+    {
+      // cannot reach zero, the job holds one more until the end of this function
+      job->m_pending_dependencies.fetch_sub(1, std::memory_order_acq_rel);
+    }
+  }
+
+  if (job->m_pending_dependencies.fetch_sub(1, std::memory_order_acq_rel) == 1)
+  {
+    schedule(job);
+  }
+
+  return job;
+}
+
+JobPtr JobSystem::submitParallelFor(size_t count,
+                                    size_t grain,
+                                    std::function<void(size_t begin, size_t end)> function)
+{
+  grain = std::max<size_t>(grain, 1);
+
+  auto shared_function = std::make_shared<std::function<void(size_t, size_t)>>(std::move(function));
+
+  std::vector<JobPtr> chunks;
+  chunks.reserve((count + grain - 1) / grain);
+
+  for (size_t begin(0); begin < count; begin += grain)
+  {
+    const size_t end = std::min(begin + grain, count);
+    chunks.push_back(submit([shared_function, begin, end]() { (*shared_function)(begin, end); }));
+  }
+
+  return submit([]() {}, chunks);
+}
+
+void JobSystem::parallelFor(size_t count, size_t grain, const std::function<void(size_t begin, size_t end)>& function)
+{
+  grain = std::max<size_t>(grain, 1);
+
+  if (count <= grain)
+  {
+    // not worth a job
+    function(0, count);
+    return;
+  }
+
+  struct State
+  {
+    const std::function<void(size_t, size_t)>* function = nullptr; ///< only used while chunks are left
+    size_t count = 0;
+    size_t grain = 0;
+    size_t chunks = 0;
+    std::atomic<size_t> next{0};      ///< next chunk to process
+    std::atomic<size_t> remaining{0}; ///< chunks not processed yet
+    QMutex mutex;
+    QWaitCondition done;
+  };
+
+  auto state = std::make_shared<State>();
+  state->function = &function;
+  state->count = count;
+  state->grain = grain;
+  state->chunks = (count + grain - 1) / grain;
+  state->remaining.store(state->chunks, std::memory_order_relaxed);
+
+  // the chunks are claimed by the caller and by helper jobs alike, so the
+  // caller never waits for a helper that is still queued behind other jobs
+  auto process_chunks = [](State& state) {
+    for (;;)
+    {
+      const size_t chunk = state.next.fetch_add(1, std::memory_order_relaxed);
+
+      if (chunk >= state.chunks)
+      {
+        return;
+      }
+
+      const size_t begin = chunk * state.grain;
+      (*state.function)(begin, std::min(begin + state.grain, state.count));
+
+      if (state.remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+      {
+        QMutexLocker lock{&state.mutex};
+        state.done.wakeAll();
+      }
+    }
+  };
+
+  const size_t helpers = std::min(state->chunks - 1, m_workers.size());
+
+  for (size_t i(0); i < helpers; ++i)
+  {
+    submit([state, process_chunks]() { process_chunks(*state); });
+  }
+
+  process_chunks(*state);
+
+  QMutexLocker lock{&state->mutex};
+
+  while (state->remaining.load(std::memory_order_acquire) != 0)
+  {
+    state->done.wait(&state->mutex);
+  }
+}
+
+void JobSystem::then(const JobPtr& job, QObject* context, std::function<void()> function)
+{
+  QPointer<QObject> guard{context};
+
+  submit(
+      [guard, function = std::move(function)]() {
+        // posted to the application object, which outlives 'context'
+        QMetaObject::invokeMethod(
+            QCoreApplication::instance(),
+            [guard, function]() {
+              if (guard)
+              {
+                function();
+              }
+            },
+            Qt::QueuedConnection);
+      },
+      {job});
+}
+
+void JobSystem::wait(const JobPtr& job)
+{
+  const bool is_worker = t_job_system == this && t_worker_index != -1;
+
+  while (!job->finished())
+  {
+    if (is_worker)
+    {
+      if (JobPtr next = take())
+      {
+        run(*next);
+        continue;
+      }
+    }
+
+    QMutexLocker lock{&m_sleep_mutex};
+
+    if (!job->finished() && (!is_worker || m_queued.load(std::memory_order_acquire) == 0))
+    {
+      m_job_finished.wait(&m_sleep_mutex);
+    }
+  }
+}
+
+void JobSystem::schedule(JobPtr job)
+{
+  const bool is_worker = t_job_system == this && t_worker_index != -1;
+  const size_t index = is_worker ? size_t(t_worker_index) : m_next_queue++ % m_queues.size();
+
+  // counted first, so that the count never goes below the number of jobs a thread can take
+  m_queued.fetch_add(1, std::memory_order_release);
+
+  {
+    Queue& queue = *m_queues[index];
+    QMutexLocker lock{&queue.mutex};
+    queue.jobs.push_back(std::move(job));
+  }
+
+  {
+    // a worker going to sleep checks 'm_queued' with the mutex locked
+    QMutexLocker lock{&m_sleep_mutex};
+  }
+
+  m_wake.wakeOne();
+}
+
+void JobSystem::finish(Job& job)
+{
+  std::vector<JobPtr> dependents;
+
+  {
+    QMutexLocker lock{&job.m_mutex};
+    job.m_finished.store(true, std::memory_order_release);
+    dependents.swap(job.m_dependents);
+  }
+
+  // releases what the function captured
+  job.m_function = nullptr;
+
+  for (JobPtr& dependent : dependents)
+  {
+    if (dependent->m_pending_dependencies.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+      schedule(std::move(dependent));
+    }
+  }
+
+  {
+    QMutexLocker lock{&m_sleep_mutex};
+  }
+
+  m_job_finished.wakeAll();
+}
+
+void JobSystem::run(Job& job)
+{
+  if (job.m_function)
+  {
+    job.m_function();
+  }
+
+  finish(job);
+}
+
+JobPtr JobSystem::pop(int worker)
+{
+  Queue& queue = *m_queues[worker];
+  QMutexLocker lock{&queue.mutex};
+
+  if (queue.jobs.empty())
+  {
+    return nullptr;
+  }
+
+  // newest first, its data is the most likely to still be in the cache
+  JobPtr job = std::move(queue.jobs.back());
+  queue.jobs.pop_back();
+  m_queued.fetch_sub(1, std::memory_order_acq_rel);
+  return job;
+}
+
+JobPtr JobSystem::steal(int thief)
+{
+  const int n = int(m_queues.size());
+  const int first = thief == -1 ? 0 : thief + 1;
+
+  for (int i(0); i < n; ++i)
+  {
+    const int victim = (first + i) % n;
+
+    if (victim == thief)
+    {
+      continue;
+    }
+
+    Queue& queue = *m_queues[victim];
+    QMutexLocker lock{&queue.mutex};
+
+    if (!queue.jobs.empty())
+    {
+      // oldest first, it is likely to be the largest piece of work
+      JobPtr job = std::move(queue.jobs.front());
+      queue.jobs.pop_front();
+      m_queued.fetch_sub(1, std::memory_order_acq_rel);
+      return job;
+    }
+  }
+
+  return nullptr;
+}
+
+JobPtr JobSystem::take()
+{
+  if (m_queued.load(std::memory_order_acquire) == 0)
+  {
+    return nullptr;
+  }
+
+  const int worker = t_job_system == this ? t_worker_index : -1;
+
+  if (worker != -1)
+  {
+    if (JobPtr job = pop(worker))
+    {
+      return job;
+    }
+  }
+
+  return steal(worker);
+}
+
+void JobSystem::workerLoop(int index)
+{
+  for (;;)
+  {
+    if (JobPtr job = take())
+    {
+      run(*job);
+      continue;
+    }
+
+    QMutexLocker lock{&m_sleep_mutex};
+
+    while (!m_quit && m_queued.load(std::memory_order_acquire) == 0)
+    {
+      m_wake.wait(&m_sleep_mutex);
+    }
+
+    if (m_quit)
+    {
+      return;
+    }
+  }
+}
@@ -0,0 +1,147 @@
+// Copyright (C) 2025 Vincent Chambrin
+// This file is part of the 'mmd-viewer' project
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include <QMutex>
+#include <QPointer>
+#include <QThread>
+#include <QWaitCondition>
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <vector>
+
+class JobSystem;
+
+/**
+ * @brief a function run by the JobSystem once all the jobs it depends on have finished
+ */
+class Job
+{
+public:
+  explicit Job(std::function<void()> function);
+  Job(const Job&) = delete;
+
+  bool finished() const;
+
+private:
+  friend class JobSystem;
+
+  std::function<void()> m_function;
+  std::atomic<int> m_pending_dependencies{1}; ///< plus one until the job is submitted
+  std::atomic<bool> m_finished{false};
+  QMutex m_mutex; ///< protects 'm_dependents', which is only appended to before the job finishes
+  std::vector<std::shared_ptr<Job>> m_dependents;
+};
+
+using JobPtr = std::shared_ptr<Job>;
+
+inline bool Job::finished() const
+{
+  return m_finished.load(std::memory_order_acquire);
+}
+
+/**
+ * @brief runs jobs on a fixed set of worker threads
+ *
+ * Each worker has a deque of ready jobs. A worker pushes the jobs it
+ * submits to its own deque and pops them from the back, which keeps the
+ * data of nested jobs warm in its cache; an idle worker steals the oldest
+ * job of another worker's deque. Jobs submitted from other threads are
+ * distributed across the workers.
+ *
+ * A worker waiting for a job runs other jobs in the meantime, so that
+ * jobs can wait for the jobs they submit without blocking a worker.
+ * Other threads, like the GUI thread, never run queued jobs: they only
+ * block, and would otherwise pick up an unrelated job such as reading
+ * a whole game.
+ *
+ * The deques are protected by a mutex each, which is cheap compared to
+ * the size of the jobs of this application (a model, an image, a clip).
+ */
+class JobSystem
+{
+public:
+  /**
+   * @brief creates a job system with one worker per core, the calling thread excluded
+   */
+  JobSystem();
+  explicit JobSystem(int workerCount);
+  ~JobSystem();
+
+  /**
+   * @brief returns the job system shared by the whole application
+   *
+   * Separate pools for each task would oversubscribe the cores.
+   */
+  static JobSystem& instance();
+
+  int workerCount() const;
+
+  /**
+   * @brief schedules a function to run once all its dependencies have finished
+   */
+  JobPtr submit(std::function<void()> function, std::initializer_list<JobPtr> dependencies = {});
+  JobPtr submit(std::function<void()> function, const std::vector<JobPtr>& dependencies);
+
+  /**
+   * @brief calls a function for each range of at most 'grain' indices in [0, count)
+   * @return a job that finishes when the whole range has been processed
+   */
+  JobPtr submitParallelFor(size_t count, size_t grain, std::function<void(size_t begin, size_t end)> function);
+
+  /**
+   * @brief same as submitParallelFor(), but waits for the result
+   *
+   * The calling thread processes ranges until none is left, and then
+   * waits for the ranges taken by the workers. It does not run any other job.
+   */
+  void parallelFor(size_t count, size_t grain, const std::function<void(size_t begin, size_t end)>& function);
+
+  /**
+   * @brief runs a function in the GUI thread once a job has finished
+   *
+   * The function is not called if 'context' has been destroyed by then.
+   * This is where the results of jobs are handed to Qt objects.
+   */
+  void then(const JobPtr& job, QObject* context, std::function<void()> function);
+
+  /**
+   * @brief waits until a job has finished
+   *
+   * A worker runs other jobs in the meantime, other threads block.
+   */
+  void wait(const JobPtr& job);
+
+private:
+  class Worker;
+
+  struct Queue
+  {
+    QMutex mutex;
+    std::deque<JobPtr> jobs;
+  };
+
+  void schedule(JobPtr job);
+  void finish(Job& job);
+  void run(Job& job);
+  JobPtr pop(int worker);
+  JobPtr steal(int thief);
+  JobPtr take();
+  void workerLoop(int index);
+
+private:
+  std::vector<std::unique_ptr<Queue>> m_queues; ///< one per worker
+  std::vector<std::unique_ptr<Worker>> m_workers;
+  std::atomic<size_t> m_next_queue{0};
+  std::atomic<int> m_queued{0}; ///< number of jobs in the queues
+  QMutex m_sleep_mutex;
+  QWaitCondition m_wake;         ///< signaled when a job is queued
+  QWaitCondition m_job_finished; ///< signaled when a job finishes
+  bool m_quit = false; ///< protected by 'm_sleep_mutex'
+};
@@ -8,6 +8,7 @@
 #include <QMatrix4x4>
 
 #include <array>
+#include <cmath>
 #include <limits>
 
 class AABB
@@ -23,9 +24,12 @@ public:
 
   AABB(const QVector3D& a, const QVector3D& b);
 
+  bool isNull() const;
+
   AABB& extend(const QVector3D& pt);
 
   QVector3D center() const;
+  QVector3D extents() const;
 
   std::array<QVector3D, 8> corners() const;
 
@@ -47,6 +51,11 @@ inline AABB::AABB(const QVector3D& a, const QVector3D& b)
   max = QVector3D(std::max(a.x(), b.x()), std::max(a.y(), b.y()), std::max(a.z(), b.z()));
 }
 
+inline bool AABB::isNull() const
+{
+  return min.x() > max.x();
+}
+
 inline AABB& AABB::extend(const QVector3D& pt)
 {
   min = QVector3D(std::min(min.x(), pt.x()), std::min(min.y(), pt.y()), std::min(min.z(), pt.z()));
@@ -59,6 +68,14 @@ inline QVector3D AABB::center() const
   return 0.5 * (min + max);
 }
 
+/**
+ * @brief returns the half-size of the box along each axis
+ */
+inline QVector3D AABB::extents() const
+{
+  return 0.5 * (max - min);
+}
+
 inline std::array<QVector3D, 8> AABB::corners() const
 {
   return {
@@ -83,25 +100,46 @@ inline bool operator!=(const AABB& lhs, const AABB& rhs)
   return !(lhs == rhs);
 }
 
+/**
+ * @brief transforms a box by an affine matrix
+ *
+ * Rather than transforming the 8 corners, the center is transformed and
+ * the extents are projected with the absolute value of the linear part of
+ * the matrix, which gives the same box for a fraction of the cost.
+ */
 inline AABB operator*(const AABB& lhs, const QMatrix4x4& tr)
 {
-  AABB result;
+  if (lhs.isNull())
+  {
+    return lhs;
+  }
+
+  const QVector3D c = lhs.center();
+  const QVector3D e = lhs.extents();
 
-  auto cs = lhs.corners();
+  QVector3D center;
+  QVector3D extents;
 
-  for (QVector3D c : cs)
+  for (int i(0); i < 3; ++i)
   {
-    QVector3D trc = tr * c; // trap: it's in that order and not 'c * tr'
-    result.extend(trc);
+    center[i] = tr(i, 0) * c.x() + tr(i, 1) * c.y() + tr(i, 2) * c.z() + tr(i, 3);
+    extents[i] = std::abs(tr(i, 0)) * e.x() + std::abs(tr(i, 1)) * e.y() + std::abs(tr(i, 2)) * e.z();
   }
 
+  AABB result;
+  result.min = center - extents;
+  result.max = center + extents;
   return result;
 }
 
 inline AABB united(const AABB& a, const AABB& b)
 {
-  return AABB(
-    QVector3D(std::min(a.min.x(), b.min.x()), std::min(a.min.y(), b.min.y()), std::min(a.min.z(), b.min.z())),
-    QVector3D(std::max(a.max.x(), b.max.x()), std::max(a.max.y(), b.max.y()), std::max(a.max.z(), b.max.z()))
-  );
+  // not using the AABB(a, b) constructor, which would turn
+  // two null boxes into an infinite one.
+  AABB result;
+  result.min =
+    QVector3D(std::min(a.min.x(), b.min.x()), std::min(a.min.y(), b.min.y()), std::min(a.min.z(), b.min.z()));
+  result.max =
+    QVector3D(std::max(a.max.x(), b.max.x()), std::max(a.max.y(), b.max.y()), std::max(a.max.z(), b.max.z()));
+  return result;
 }
@@ -0,0 +1,24 @@
+// Copyright (C) 2025 Vincent Chambrin
+// This file is part of the 'mmd-viewer' project
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "frustum.h"
+
+Frustum::Frustum(const QMatrix4x4& viewProjection)
+{
+  // Gribb & Hartmann: the planes are sums and differences of the rows
+  // of the matrix, in clip space -w <= x, y, z <= w.
+  const QVector4D r0 = viewProjection.row(0);
+  const QVector4D r1 = viewProjection.row(1);
+  const QVector4D r2 = viewProjection.row(2);
+  const QVector4D r3 = viewProjection.row(3);
+
+  m_planes = {
+    r3 + r0, // left
+    r3 - r0, // right
+    r3 + r1, // bottom
+    r3 - r1, // top
+    r3 + r2, // near
+    r3 - r2, // far
+  };
+}
@@ -0,0 +1,67 @@
+// Copyright (C) 2025 Vincent Chambrin
+// This file is part of the 'mmd-viewer' project
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "aabb.h"
+
+#include <QMatrix4x4>
+#include <QVector4D>
+
+#include <array>
+
+/**
+ * @brief the six clipping planes of a view-projection matrix
+ *
+ * Each plane is stored as (a, b, c, d) with its normal pointing inside
+ * the frustum: a point p is on the inner side if a*x + b*y + c*z + d >= 0.
+ */
+class Frustum
+{
+public:
+  Frustum() = default;
+  explicit Frustum(const QMatrix4x4& viewProjection);
+
+  const std::array<QVector4D, 6>& planes() const;
+
+  bool intersects(const AABB& box) const;
+
+private:
+  std::array<QVector4D, 6> m_planes;
+};
+
+inline const std::array<QVector4D, 6>& Frustum::planes() const
+{
+  return m_planes;
+}
+
+/**
+ * @brief returns whether a box is at least partially inside the frustum
+ *
+ * The test is conservative: a box close to a corner of the frustum may
+ * be reported as intersecting even though it is outside.
+ */
+inline bool Frustum::intersects(const AABB& box) const
+{
+  if (box.isNull())
+  {
+    return false;
+  }
+
+  const QVector3D c = box.center();
+  const QVector3D e = box.extents();
+
+  for (const QVector4D& p : m_planes)
+  {
+    const float distance = p.x() * c.x() + p.y() * c.y() + p.z() * c.z() + p.w();
+    const float radius = std::abs(p.x()) * e.x() + std::abs(p.y()) * e.y() + std::abs(p.z()) * e.z();
+
+    if (distance + radius < 0)
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
@@ -10,8 +10,12 @@
  */
 
 #include <QOpenGLFunctions>
+#include <QOpenGLExtraFunctions>
 #include <QOpenGLBuffer>
 
+#include <algorithm>
+#include <array>
+#include <cstdint>
 #include <memory>
 #include <vector>
 
@@ -114,6 +118,28 @@ inline void setup_buffer(std::unique_ptr<QOpenGLBuffer>& ptr,
   gl->glEnableVertexAttribArray(specs.index);
 }
 
+/**
+ * @brief binds another attribute of an existing buffer
+ * @param vbo    the buffer, usually created by setup_buffer()
+ * @param gl     pointer to the OpenGL functions
+ * @param specs  specifications of the attribute
+ *
+ * This is used for interleaved buffers, in which several attributes
+ * share the same buffer with a different offset.
+ * The @a specs are used to bind the buffer to the currently bound VAO.
+ */
+inline void setup_attribute(QOpenGLBuffer& vbo, QOpenGLFunctions* gl, BufferSpecs specs)
+{
+  vbo.bind();
+
+  gl->glVertexAttribPointer(
+    specs.index, specs.tuplesize, specs.type, specs.normalized, specs.stride, specs.offset);
+
+  vbo.release();
+
+  gl->glEnableVertexAttribArray(specs.index);
+}
+
 inline void setup_index_buffer(std::unique_ptr<QOpenGLBuffer>& ptr,
                                QOpenGLFunctions* gl,
                                BufferData data,
@@ -211,3 +237,183 @@ inline void update_buffer(std::unique_ptr<QOpenGLBuffer>& ptr, BufferData data)
   vbo->allocate(data.ptr, data.size);
   vbo->release();
 }
+
+/**
+ * @brief a ring buffer for data that is written by the CPU every frame
+ *
+ * The buffer is split in FRAMES segments, one per frame in flight.
+ * Each frame, the next segment is mapped with glMapBufferRange() using
+ * the unsynchronized and invalidate-range flags, so that the driver
+ * neither copies nor waits for the buffer.
+ *
+ * Between beginFrame() and unmap(), allocate() sub-allocates ranges
+ * of the current segment, e.g. for uniform blocks, bone palettes or
+ * instance arrays. The ranges are bound with their offset in the buffer,
+ * for example with glBindBufferRange(), once the segment is unmapped.
+ *
+ * endFrame() must be called after the last draw call reading the segment:
+ * it inserts the fence that tells when the segment can be written again.
+ *
+ * @note the OpenGL context must be current when calling any function,
+ * including the destructor.
+ */
+class StreamingBuffer
+{
+public:
+  static constexpr int FRAMES = 3;
+
+  struct Allocation
+  {
+    void* ptr = nullptr;     ///< where to write the data, valid until unmap()
+    GLintptr offset = 0;     ///< offset of the range in the buffer
+    GLsizeiptr size = 0;     ///< size of the range
+
+    explicit operator bool() const { return ptr != nullptr; }
+  };
+
+public:
+  StreamingBuffer(QOpenGLExtraFunctions* gl, GLenum target, GLsizeiptr frameCapacity)
+    : m_gl(gl)
+    , m_target(target)
+  {
+    m_gl->glGenBuffers(1, &m_buffer);
+    reserve(frameCapacity);
+  }
+
+  StreamingBuffer(const StreamingBuffer&) = delete;
+
+  ~StreamingBuffer()
+  {
+    releaseFences();
+    m_gl->glDeleteBuffers(1, &m_buffer);
+  }
+
+  GLuint bufferId() const { return m_buffer; }
+  GLenum target() const { return m_target; }
+  GLsizeiptr frameCapacity() const { return m_capacity; }
+
+  /**
+   * @brief makes sure that a frame can allocate @a frameSize bytes
+   *
+   * This reallocates the whole buffer if it is too small and must not
+   * be called between beginFrame() and endFrame().
+   */
+  void reserve(GLsizeiptr frameSize)
+  {
+    if (frameSize <= m_capacity)
+    {
+      return;
+    }
+
+    // grows geometrically to avoid reallocating every frame while a scene
+    // is being loaded; the previous storage is orphaned, not waited for.
+    m_capacity = std::max(frameSize, m_capacity + m_capacity / 2);
+
+    m_gl->glBindBuffer(m_target, m_buffer);
+    m_gl->glBufferData(m_target, m_capacity * FRAMES, nullptr, GL_STREAM_DRAW);
+    m_gl->glBindBuffer(m_target, 0);
+
+    releaseFences();
+  }
+
+  void beginFrame()
+  {
+    m_segment = (m_segment + 1) % FRAMES;
+    m_head = 0;
+
+    // waits for the GPU to be done with the frame that last used the segment
+    if (GLsync& fence = m_fences[m_segment])
+    {
+      while (m_gl->glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED) { }
+
+      m_gl->glDeleteSync(fence);
+      fence = nullptr;
+    }
+
+    m_gl->glBindBuffer(m_target, m_buffer);
+    m_mapped = static_cast<uint8_t*>(m_gl->glMapBufferRange(m_target,
+                                                            segmentOffset(),
+                                                            m_capacity,
+                                                            GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT
+                                                              | GL_MAP_INVALIDATE_RANGE_BIT
+                                                              | GL_MAP_FLUSH_EXPLICIT_BIT));
+    m_gl->glBindBuffer(m_target, 0);
+  }
+
+  /**
+   * @brief allocates @a size bytes in the current frame
+   *
+   * Returns an empty allocation if the segment is full, see reserve().
+   */
+  Allocation allocate(GLsizeiptr size, GLintptr alignment = 16)
+  {
+    const GLintptr start = (m_head + alignment - 1) / alignment * alignment;
+
+    if (!m_mapped || start + size > m_capacity)
+    {
+      return Allocation();
+    }
+
+    m_head = start + size;
+
+    Allocation result;
+    result.ptr = m_mapped + start;
+    result.offset = segmentOffset() + start;
+    result.size = size;
+    return result;
+  }
+
+  /**
+   * @brief makes the data written in the current segment visible to the GPU
+   *
+   * Must be called before drawing with the allocated ranges.
+   */
+  void unmap()
+  {
+    if (m_mapped)
+    {
+      m_gl->glBindBuffer(m_target, m_buffer);
+      m_gl->glFlushMappedBufferRange(m_target, 0, m_head);
+      m_gl->glUnmapBuffer(m_target);
+      m_gl->glBindBuffer(m_target, 0);
+      m_mapped = nullptr;
+    }
+  }
+
+  /**
+   * @brief ends the frame, after the last draw call reading the segment
+   */
+  void endFrame()
+  {
+    unmap();
+
+    // signaled once the draws submitted before it, which include all the
+    // draws reading this segment, are done
+    m_fences[m_segment] = m_gl->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  }
+
+private:
+  GLintptr segmentOffset() const { return GLintptr(m_segment) * m_capacity; }
+
+  void releaseFences()
+  {
+    for (GLsync& fence : m_fences)
+    {
+      if (fence)
+      {
+        m_gl->glDeleteSync(fence);
+        fence = nullptr;
+      }
+    }
+  }
+
+private:
+  QOpenGLExtraFunctions* m_gl;
+  GLenum m_target;
+  GLuint m_buffer = 0;
+  GLsizeiptr m_capacity = 0;
+  int m_segment = 0;
+  GLintptr m_head = 0;
+  uint8_t* m_mapped = nullptr;
+  std::array<GLsync, FRAMES> m_fences = {};
+};
@@ -0,0 +1,342 @@
+// Copyright (C) 2025 Vincent Chambrin
+// This file is part of the 'mmd-viewer' project
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "psxcolor.h"
+
+#include <array>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PSXCOLOR_SSE2
+#include <emmintrin.h>
+#endif
+
+// AVX2 and SSSE3 kernels are compiled with a target attribute and selected
+// at runtime with GCC and Clang; with MSVC they require /arch:AVX2.
+#if defined(PSXCOLOR_SSE2)
+#if defined(__GNUC__) || defined(__clang__)
+#define PSXCOLOR_AVX2
+#define PSXCOLOR_SSSE3
+#define PSXCOLOR_TARGET(isa) __attribute__((target(isa)))
+#include <immintrin.h>
+static bool cpu_has_avx2()
+{
+  static const bool result = __builtin_cpu_supports("avx2");
+  return result;
+}
+static bool cpu_has_ssse3()
+{
+  static const bool result = __builtin_cpu_supports("ssse3");
+  return result;
+}
+#elif defined(__AVX2__)
+#define PSXCOLOR_AVX2
+#define PSXCOLOR_SSSE3
+#define PSXCOLOR_TARGET(isa)
+#include <immintrin.h>
+static bool cpu_has_avx2()
+{
+  return true;
+}
+static bool cpu_has_ssse3()
+{
+  return true;
+}
+#endif
+#endif
+
+const uint32_t* psx16_lut()
+{
+  static const std::array<uint32_t, 0x10000> table = []() {
+    std::array<uint32_t, 0x10000> result;
+
+    for (uint32_t c(0); c < result.size(); ++c)
+    {
+      result[c] = psx16_to_argb(uint16_t(c));
+    }
+
+    return result;
+  }();
+
+  return table.data();
+}
+
+#if defined(PSXCOLOR_SSE2)
+
+// round(x * 255 / 31) on 16-bit lanes, see psx16_to_argb()
+static inline __m128i expand5_sse2(__m128i x)
+{
+  x = _mm_mullo_epi16(x, _mm_set1_epi16(527));
+  x = _mm_add_epi16(x, _mm_set1_epi16(23));
+  return _mm_srli_epi16(x, 6);
+}
+
+static size_t psx16_to_argb_sse2(const uint16_t* src, uint32_t* dst, size_t n)
+{
+  const __m128i mask5 = _mm_set1_epi16(0x1F);
+  const __m128i mask15 = _mm_set1_epi16(0x7FFF);
+  const __m128i mask8 = _mm_set1_epi16(0xFF);
+  const __m128i zero = _mm_setzero_si128();
+
+  size_t i = 0;
+
+  for (; i + 8 <= n; i += 8)
+  {
+    const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+
+    const __m128i r = expand5_sse2(_mm_and_si128(c, mask5));
+    const __m128i g = expand5_sse2(_mm_and_si128(_mm_srli_epi16(c, 5), mask5));
+    const __m128i b = expand5_sse2(_mm_and_si128(_mm_srli_epi16(c, 10), mask5));
+
+    // alpha is 255 when the stp bit matches "is black"
+    const __m128i black = _mm_cmpeq_epi16(_mm_and_si128(c, mask15), zero);
+    const __m128i stp = _mm_srai_epi16(c, 15);
+    const __m128i a = _mm_andnot_si128(_mm_xor_si128(black, stp), mask8);
+
+    // interleaving (g << 8 | b) with (a << 8 | r) gives 0xAARRGGBB
+    const __m128i bg = _mm_or_si128(b, _mm_slli_epi16(g, 8));
+    const __m128i ar = _mm_or_si128(r, _mm_slli_epi16(a, 8));
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_unpacklo_epi16(bg, ar));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i + 4), _mm_unpackhi_epi16(bg, ar));
+  }
+
+  return i;
+}
+
+#endif // PSXCOLOR_SSE2
+
+#if defined(PSXCOLOR_AVX2)
+
+PSXCOLOR_TARGET("avx2") static inline __m256i expand5_avx2(__m256i x)
+{
+  x = _mm256_mullo_epi16(x, _mm256_set1_epi16(527));
+  x = _mm256_add_epi16(x, _mm256_set1_epi16(23));
+  return _mm256_srli_epi16(x, 6);
+}
+
+PSXCOLOR_TARGET("avx2") static size_t psx16_to_argb_avx2(const uint16_t* src, uint32_t* dst, size_t n)
+{
+  const __m256i mask5 = _mm256_set1_epi16(0x1F);
+  const __m256i mask15 = _mm256_set1_epi16(0x7FFF);
+  const __m256i mask8 = _mm256_set1_epi16(0xFF);
+  const __m256i zero = _mm256_setzero_si256();
+
+  size_t i = 0;
+
+  for (; i + 16 <= n; i += 16)
+  {
+    const __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+
+    const __m256i r = expand5_avx2(_mm256_and_si256(c, mask5));
+    const __m256i g = expand5_avx2(_mm256_and_si256(_mm256_srli_epi16(c, 5), mask5));
+    const __m256i b = expand5_avx2(_mm256_and_si256(_mm256_srli_epi16(c, 10), mask5));
+
+    const __m256i black = _mm256_cmpeq_epi16(_mm256_and_si256(c, mask15), zero);
+    const __m256i stp = _mm256_srai_epi16(c, 15);
+    const __m256i a = _mm256_andnot_si256(_mm256_xor_si256(black, stp), mask8);
+
+    const __m256i bg = _mm256_or_si256(b, _mm256_slli_epi16(g, 8));
+    const __m256i ar = _mm256_or_si256(r, _mm256_slli_epi16(a, 8));
+
+    // unpacking works within 128-bit lanes: lo = [0..3, 8..11], hi = [4..7, 12..15]
+    const __m256i lo = _mm256_unpacklo_epi16(bg, ar);
+    const __m256i hi = _mm256_unpackhi_epi16(bg, ar);
+
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_permute2x128_si256(lo, hi, 0x20));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i + 8), _mm256_permute2x128_si256(lo, hi, 0x31));
+  }
+
+  return i;
+}
+
+PSXCOLOR_TARGET("avx2") static size_t expand_clut8_avx2(const uint8_t* src, const uint32_t* clut, uint32_t* dst,
+                                                        size_t n)
+{
+  size_t i = 0;
+
+  for (; i + 8 <= n; i += 8)
+  {
+    const __m128i c = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + i));
+    const __m256i indices = _mm256_cvtepu8_epi32(c);
+    const __m256i colors = _mm256_i32gather_epi32(reinterpret_cast<const int*>(clut), indices, 4);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), colors);
+  }
+
+  return i;
+}
+
+#endif // PSXCOLOR_AVX2
+
+#if defined(PSXCOLOR_SSSE3)
+
+PSXCOLOR_TARGET("ssse3") static size_t psx24_to_argb_ssse3(const uint8_t* src, uint32_t* dst, size_t n)
+{
+  // R, G, B bytes to B, G, R, 0 ; -1 writes a zero
+  const __m128i shuffle = _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+  const __m128i alpha = _mm_set1_epi32(int(0xFF000000));
+
+  size_t i = 0;
+
+  // 4 pixels per iteration, but 16 bytes are read
+  for (; 3 * i + 16 <= 3 * n; i += 4)
+  {
+    const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 3 * i));
+    const __m128i argb = _mm_or_si128(_mm_shuffle_epi8(c, shuffle), alpha);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), argb);
+  }
+
+  return i;
+}
+
+// looks up 16 indices in tables holding byte 0, 1, 2 and 3 of the 16 palette colors
+PSXCOLOR_TARGET("ssse3") static inline void lookup16_ssse3(const __m128i* tables, __m128i indices, uint32_t* dst)
+{
+  const __m128i b0 = _mm_shuffle_epi8(tables[0], indices);
+  const __m128i b1 = _mm_shuffle_epi8(tables[1], indices);
+  const __m128i b2 = _mm_shuffle_epi8(tables[2], indices);
+  const __m128i b3 = _mm_shuffle_epi8(tables[3], indices);
+
+  const __m128i b01lo = _mm_unpacklo_epi8(b0, b1);
+  const __m128i b01hi = _mm_unpackhi_epi8(b0, b1);
+  const __m128i b23lo = _mm_unpacklo_epi8(b2, b3);
+  const __m128i b23hi = _mm_unpackhi_epi8(b2, b3);
+
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm_unpacklo_epi16(b01lo, b23lo));
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 4), _mm_unpackhi_epi16(b01lo, b23lo));
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 8), _mm_unpacklo_epi16(b01hi, b23hi));
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 12), _mm_unpackhi_epi16(b01hi, b23hi));
+}
+
+PSXCOLOR_TARGET("ssse3") static size_t expand_clut4_ssse3(const uint8_t* src, const uint32_t* clut, uint32_t* dst,
+                                                          size_t n)
+{
+  // split the palette into byte planes: each load of 4 colors becomes
+  // [byte 0 x4, byte 1 x4, byte 2 x4, byte 3 x4], which is then transposed.
+  const __m128i bytes = _mm_setr_epi8(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15);
+  __m128i quads[4];
+
+  for (int k(0); k < 4; ++k)
+  {
+    quads[k] = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(clut + 4 * k)), bytes);
+  }
+
+  const __m128i q01lo = _mm_unpacklo_epi32(quads[0], quads[1]);
+  const __m128i q01hi = _mm_unpackhi_epi32(quads[0], quads[1]);
+  const __m128i q23lo = _mm_unpacklo_epi32(quads[2], quads[3]);
+  const __m128i q23hi = _mm_unpackhi_epi32(quads[2], quads[3]);
+
+  const __m128i tables[4] = {
+      _mm_unpacklo_epi64(q01lo, q23lo),
+      _mm_unpackhi_epi64(q01lo, q23lo),
+      _mm_unpacklo_epi64(q01hi, q23hi),
+      _mm_unpackhi_epi64(q01hi, q23hi),
+  };
+
+  const __m128i mask4 = _mm_set1_epi8(0x0F);
+
+  size_t i = 0;
+
+  // 32 pixels per iteration, from 16 bytes
+  for (; i + 32 <= n; i += 32)
+  {
+    const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i / 2));
+    const __m128i lo = _mm_and_si128(c, mask4);
+    const __m128i hi = _mm_and_si128(_mm_srli_epi16(c, 4), mask4);
+    lookup16_ssse3(tables, _mm_unpacklo_epi8(lo, hi), dst + i);
+    lookup16_ssse3(tables, _mm_unpackhi_epi8(lo, hi), dst + i + 16);
+  }
+
+  return i;
+}
+
+#endif // PSXCOLOR_SSSE3
+
+void psx16_to_argb(const uint16_t* src, uint32_t* dst, size_t n)
+{
+  size_t i = 0;
+
+#if defined(PSXCOLOR_SSE2)
+
+#if defined(PSXCOLOR_AVX2)
+  if (cpu_has_avx2())
+  {
+    i = psx16_to_argb_avx2(src, dst, n);
+  }
+#endif
+
+  i += psx16_to_argb_sse2(src + i, dst + i, n - i);
+
+  for (; i < n; ++i)
+  {
+    dst[i] = psx16_to_argb(src[i]);
+  }
+
+#else
+
+  const uint32_t* lut = psx16_lut();
+
+  for (; i < n; ++i)
+  {
+    dst[i] = lut[src[i]];
+  }
+
+#endif
+}
+
+void psx24_to_argb(const uint8_t* src, uint32_t* dst, size_t n)
+{
+  size_t i = 0;
+
+#if defined(PSXCOLOR_SSSE3)
+  if (cpu_has_ssse3())
+  {
+    i = psx24_to_argb_ssse3(src, dst, n);
+  }
+#endif
+
+  for (; i < n; ++i)
+  {
+    const uint32_t red = src[3 * i];
+    const uint32_t green = src[3 * i + 1];
+    const uint32_t blue = src[3 * i + 2];
+    dst[i] = 0xFF000000u | (red << 16) | (green << 8) | blue;
+  }
+}
+
+void expand_clut4(const uint16_t* src, const uint32_t* clut, uint32_t* dst, size_t n)
+{
+  // indices are read as bytes, two per byte with the first in the low bits
+  const auto* bytes = reinterpret_cast<const uint8_t*>(src);
+  size_t i = 0;
+
+#if defined(PSXCOLOR_SSSE3)
+  if (cpu_has_ssse3())
+  {
+    i = expand_clut4_ssse3(bytes, clut, dst, n);
+  }
+#endif
+
+  for (; i < n; ++i)
+  {
+    dst[i] = clut[(bytes[i / 2] >> (4 * (i % 2))) & 0xF];
+  }
+}
+
+void expand_clut8(const uint16_t* src, const uint32_t* clut, uint32_t* dst, size_t n)
+{
+  const auto* bytes = reinterpret_cast<const uint8_t*>(src);
+  size_t i = 0;
+
+#if defined(PSXCOLOR_AVX2)
+  if (cpu_has_avx2())
+  {
+    i = expand_clut8_avx2(bytes, clut, dst, n);
+  }
+#endif
+
+  for (; i < n; ++i)
+  {
+    dst[i] = clut[bytes[i]];
+  }
+}
@@ -0,0 +1,81 @@
+// Copyright (C) 2025 Vincent Chambrin
+// This file is part of the 'mmd-viewer' project
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+/**
+ * @file psxcolor.h
+ * @brief conversion of PlayStation colors to 32-bit ARGB (0xAARRGGBB)
+ */
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief converts a A1B5G5R5 color
+ *
+ * Each 5-bit channel is scaled to 8 bits with rounding.
+ * Alpha follows the PSX rules: black (0x0000) is transparent, a color
+ * with the STP bit set is transparent, unless it is black.
+ */
+constexpr uint32_t psx16_to_argb(uint16_t c)
+{
+  // round(x * 255 / 31) for x in [0, 31]
+  auto expand = [](uint32_t x) -> uint32_t { return (x * 527 + 23) >> 6; };
+
+  const uint32_t red = expand(c & 0x1F);
+  const uint32_t green = expand((c >> 5) & 0x1F);
+  const uint32_t blue = expand((c >> 10) & 0x1F);
+
+  const bool stp = c & 0x8000;
+  const bool black = (c & 0x7FFF) == 0;
+  const uint32_t alpha = stp == black ? 0xFF : 0;
+
+  return (alpha << 24) | (red << 16) | (green << 8) | blue;
+}
+
+/**
+ * @brief converts an array of A1B5G5R5 colors
+ * @param src  the 16-bit colors
+ * @param dst  the output, must have room for @a n colors
+ * @param n    number of colors
+ *
+ * This uses SSE2 or AVX2 when available and a lookup table otherwise.
+ */
+void psx16_to_argb(const uint16_t* src, uint32_t* dst, size_t n);
+
+/**
+ * @brief converts an array of 24-bit colors, stored as R, G, B bytes
+ * @param src  the 24-bit colors, 3 * @a n bytes
+ * @param dst  the output, must have room for @a n colors
+ * @param n    number of colors
+ */
+void psx24_to_argb(const uint8_t* src, uint32_t* dst, size_t n);
+
+/**
+ * @brief returns a table of the 65536 converted A1B5G5R5 colors
+ */
+const uint32_t* psx16_lut();
+
+/**
+ * @brief expands 4-bit palette indices to colors
+ * @param src   the indices, four per 16-bit word, starting with the low bits
+ * @param clut  the 16 colors of the palette
+ * @param dst   the output, must have room for @a n colors
+ * @param n     number of pixels
+ *
+ * This uses SSSE3 when available, the palette then fits a byte shuffle table.
+ */
+void expand_clut4(const uint16_t* src, const uint32_t* clut, uint32_t* dst, size_t n);
+
+/**
+ * @brief expands 8-bit palette indices to colors
+ * @param src   the indices, two per 16-bit word, starting with the low bits
+ * @param clut  the 256 colors of the palette
+ * @param dst   the output, must have room for @a n colors
+ * @param n     number of pixels
+ *
+ * This uses AVX2 gathers when available.
+ */
+void expand_clut8(const uint16_t* src, const uint32_t* clut, uint32_t* dst, size_t n);
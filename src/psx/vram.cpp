@@ -0,0 +1,95 @@
+// Copyright (C) 2025 Vincent Chambrin
+// This file is part of the 'mmd-viewer' project
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "vram.h"
+
+#include "formats/tim.h"
+
+#include <cstring>
+#include <vector>
+
+/**
+ * @brief writes a rectangle of pixels
+ *
+ * The part of the rectangle that is outside of the VRAM is ignored.
+ */
+void VRAM::write(int x, int y, int width, int height, const uint16_t* pixels)
+{
+  const int x0 = std::max(x, 0);
+  const int x1 = std::min(x + width, WIDTH);
+
+  if (x0 >= x1)
+  {
+    return;
+  }
+
+  for (int row = std::max(y, 0); row < std::min(y + height, HEIGHT); ++row)
+  {
+    const uint16_t* src = pixels + (row - y) * width + (x0 - x);
+    std::memcpy(data.data() + row * WIDTH + x0, src, (x1 - x0) * sizeof(uint16_t));
+  }
+}
+
+/**
+ * @brief copies a rectangle of pixels to another location
+ *
+ * The source and destination may overlap.
+ * Both rectangles are clipped to the VRAM.
+ */
+void VRAM::copy(int srcX, int srcY, int width, int height, int destX, int destY)
+{
+  const int left = std::max(-std::min(srcX, destX), 0);
+  const int top = std::max(-std::min(srcY, destY), 0);
+  srcX += left;
+  destX += left;
+  srcY += top;
+  destY += top;
+  width = std::min({width - left, WIDTH - srcX, WIDTH - destX});
+  height = std::min({height - top, HEIGHT - srcY, HEIGHT - destY});
+
+  if (width <= 0 || height <= 0)
+  {
+    return;
+  }
+
+  // when moving down, go bottom-up so that source lines are read before being overwritten
+  const bool bottom_up = destY > srcY;
+
+  for (int i(0); i < height; ++i)
+  {
+    const int row = bottom_up ? height - 1 - i : i;
+    uint16_t* dst = data.data() + (destY + row) * WIDTH + destX;
+    const uint16_t* src = data.data() + (srcY + row) * WIDTH + srcX;
+    std::memmove(dst, src, width * sizeof(uint16_t));
+  }
+}
+
+/**
+ * @brief writes the pixels and the color palettes of a TIM at their location
+ */
+void VRAM::load(const TimImage& image)
+{
+  const std::vector<u16>& pixels = image.pixelData();
+
+  if (image.height() > 0)
+  {
+    const int width = int(pixels.size()) / image.height();
+    write(image.getPixelX(), image.getPixelY(), width, image.height(), pixels.data());
+  }
+
+  if (image.usesPalette())
+  {
+    const TimImage::Palettes& palettes = image.palettes();
+    const std::vector<u16>& colors = palettes.rawColors();
+
+    if (!colors.empty())
+    {
+      write(palettes.x(),
+            palettes.y(),
+            palettes.numberOfColorsPerPalette(),
+            palettes.numberOfPalettes(),
+            colors.data());
+    }
+  }
+}
@@ -5,11 +5,29 @@
 #include <algorithm>
 #include <array>
 
+class TimImage;
+
+/**
+ * @brief the 1024x512 16-bit video memory of the PlayStation
+ *
+ * Coordinates are expressed in 16-bit units: a 4bpp texel takes a quarter
+ * of a unit and a 8bpp texel half of a unit.
+ */
 class VRAM
 {
 public:
-  std::array<uint16_t, 1024 * 512> data;
+  static constexpr int WIDTH = 1024;
+  static constexpr int HEIGHT = 512;
+
+  std::array<uint16_t, WIDTH * HEIGHT> data;
 
 public:
   VRAM() { std::fill(data.begin(), data.end(), uint16_t(0)); }
+
+  uint16_t at(int x, int y) const { return data[y * WIDTH + x]; }
+
+  void write(int x, int y, int width, int height, const uint16_t* pixels);
+  void copy(int srcX, int srcY, int width, int height, int destX, int destY);
+
+  void load(const TimImage& image);
 };
@@ -0,0 +1,156 @@
+// Copyright (C) 2025 Vincent Chambrin
+// This file is part of the 'mmd-viewer' project
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "flatscene.h"
+
+#include "psxobject3d.h"
+#include "vertexanimation.h"
+
+void FlatScene::update(Object3D& root, const QMatrix4x4& rootTransform)
+{
+  bool root_changed = rootTransform != m_rootTransform;
+
+  if (&root != m_root || root.hierarchyRevision() != m_hierarchyRevision)
+  {
+    rebuild(root);
+    root_changed = true;
+  }
+
+  m_rootTransform = rootTransform;
+  m_changed = root_changed;
+
+  for (int i(0); i < int(m_nodes.size()); ++i)
+  {
+    Node& node = m_nodes[i];
+    const bool parent_changed = node.parent == -1 ? root_changed : m_nodes[node.parent].changed;
+    node.changed = parent_changed || node.revision != node.object->transformRevision();
+    m_changed = m_changed || node.changed;
+
+    if (node.changed)
+    {
+      const QMatrix4x4& parent_world = node.parent == -1 ? m_rootTransform : m_nodes[node.parent].world;
+      node.world = parent_world * node.object->matrix();
+      node.revision = node.object->transformRevision();
+
+      if (node.renderable)
+      {
+        node.bounds = node.mesh->bounds * node.world;
+      }
+    }
+
+    if (node.animationRoot == i)
+    {
+      // roots come before the nodes they animate
+      const auto& root = static_cast<const VertexAnimatedObject&>(*node.object);
+      const BakedAnimations::Clip* clip = root.playingClip();
+      std::shared_ptr<BakedAnimations> animations = clip ? root.bakedAnimations() : nullptr;
+      const VertexAnimatedObject::Playback& playback = root.playback();
+
+      if (animations != node.playingAnimations || playback.clip != node.playback.clip
+          || playback.frame != node.playback.frame || playback.timeOffset != node.playback.timeOffset)
+      {
+        m_changed = true;
+      }
+
+      node.playingAnimations = animations;
+      node.playingClip = clip ? *clip : BakedAnimations::Clip();
+      node.playback = playback;
+    }
+
+    if (node.renderable && node.animatedNode != -1)
+    {
+      // starting or stopping a clip does not change the transform revisions
+      const Node& root = m_nodes[node.animationRoot];
+
+      if (root.playingAnimations)
+      {
+        node.bounds = root.playingAnimations->bounds * parentWorld(node.animationRoot);
+      }
+      else if (!node.changed)
+      {
+        node.bounds = node.mesh->bounds * node.world;
+      }
+    }
+
+    node.subtreeBounds = node.bounds;
+  }
+
+  // children are stored after their parent, a reverse traversal
+  // completes the bounds of a subtree before they are merged into the parent.
+  for (size_t i = m_nodes.size(); i-- > 1;)
+  {
+    const Node& node = m_nodes[i];
+    Node& parent = m_nodes[node.parent];
+    parent.subtreeBounds = united(parent.subtreeBounds, node.subtreeBounds);
+  }
+}
+
+void FlatScene::rebuild(Object3D& root)
+{
+  m_root = &root;
+  m_hierarchyRevision = root.hierarchyRevision();
+  m_nodes.clear();
+  m_renderables.clear();
+
+  // iterative depth-first traversal, each entry is a node index and the
+  // index of the next child of that node to visit.
+  std::vector<std::pair<int, int>> stack;
+
+  auto push_node = [this, &stack](Object3D* object, int parent) {
+    Node node;
+    node.object = object;
+    node.parent = parent;
+    node.revision = object->transformRevision();
+
+    const int index = int(m_nodes.size());
+
+    if (dynamic_cast<VertexAnimatedObject*>(object))
+    {
+      node.animationRoot = index;
+    }
+    else if (parent != -1)
+    {
+      node.animationRoot = m_nodes[parent].animationRoot;
+    }
+
+    if (node.animationRoot != -1)
+    {
+      const Object3D* root = node.animationRoot == index ? object : m_nodes[node.animationRoot].object;
+      node.animatedNode = static_cast<const VertexAnimatedObject*>(root)->animatedNodeIndex(object);
+    }
+
+    m_nodes.push_back(node);
+
+    if (auto* psxobj = dynamic_cast<PSX_Object3D*>(object))
+    {
+      Node& back = m_nodes.back();
+      back.renderable = psxobj;
+      back.mesh = psxobj->mesh;
+      back.primitives = psxobj->primitives;
+      back.materials = psxobj->materials;
+      m_renderables.push_back(Renderable{psxobj, index});
+    }
+
+    stack.emplace_back(index, 0);
+  };
+
+  push_node(&root, -1);
+
+  while (!stack.empty())
+  {
+    const int index = stack.back().first;
+    const int child = stack.back().second++;
+    Object3D* object = m_nodes[index].object;
+
+    if (child < object->childCount())
+    {
+      push_node(object->childAt(child), index);
+    }
+    else
+    {
+      m_nodes[index].subtreeEnd = int(m_nodes.size());
+      stack.pop_back();
+    }
+  }
+}
@@ -0,0 +1,150 @@
+// Copyright (C) 2025 Vincent Chambrin
+// This file is part of the 'mmd-viewer' project
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "object3d.h"
+#include "psxobject3d.h"
+#include "vertexanimation.h"
+
+#include "math/aabb.h"
+
+#include <QMatrix4x4>
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/**
+ * @brief a linearized view of a scene graph
+ *
+ * The nodes of the scene are stored in depth-first order, so that
+ * the parent of a node always comes before the node itself and the
+ * descendants of a node are stored right after it.
+ *
+ * The world matrix of each node is cached and only recomputed when the
+ * local transform of the node (or of one of its ancestors) has changed.
+ * The list is rebuilt when a node is added or removed from the scene.
+ *
+ * Each node also stores the world-space bounds of its own mesh and of
+ * its whole subtree, so that an off-screen subtree can be skipped at once
+ * by jumping to its 'subtreeEnd'.
+ *
+ * While a VertexAnimatedObject plays a baked clip, the bounds of its
+ * animated nodes are the bounds of the whole animation, as their
+ * transforms are only known by the vertex shader.
+ *
+ * After update(), the nodes hold everything the renderer reads from the
+ * scene, and own the meshes and materials they draw, so that a frame can
+ * be prepared from them while the scene is being modified, or deleted.
+ */
+class FlatScene
+{
+public:
+  struct Node
+  {
+    Object3D* object = nullptr;
+    int parent = -1;     ///< index of the parent node, -1 for the root
+    int subtreeEnd = 0;  ///< index one past the last descendant of the node
+    QMatrix4x4 world;    ///< cached world matrix
+    uint32_t revision;   ///< transform revision of the object when 'world' was computed
+    bool changed = true; ///< whether 'world' was recomputed during the last update()
+    PSX_Object3D* renderable = nullptr; ///< the object as a PSX_Object3D, if it is one
+    // copied from 'renderable' when the list is rebuilt
+    std::shared_ptr<PSX_Mesh> mesh;
+    std::vector<PSX_Object3D::PrimitiveInfo> primitives;
+    std::vector<std::shared_ptr<PSX_Material>> materials;
+    AABB bounds;        ///< world bounds of the node's mesh
+    AABB subtreeBounds; ///< world bounds of the node and all its descendants
+    int animationRoot = -1; ///< index of the closest VertexAnimatedObject, the node included
+    int animatedNode = -1;  ///< index of the node in the baked animations of 'animationRoot'
+    std::shared_ptr<BakedAnimations> playingAnimations; ///< set on a VertexAnimatedObject playing a clip
+    BakedAnimations::Clip playingClip;                  ///< the clip, if 'playingAnimations' is set
+    VertexAnimatedObject::Playback playback;            ///< the playback, if 'playingAnimations' is set
+  };
+
+  struct Renderable
+  {
+    PSX_Object3D* object;
+    int node;
+  };
+
+  FlatScene() = default;
+
+  void update(Object3D& root, const QMatrix4x4& rootTransform);
+
+  /**
+   * @brief returns whether the last update() changed a world matrix or a playback
+   */
+  bool changed() const;
+
+  const std::vector<Node>& nodes() const;
+  const std::vector<Renderable>& renderables() const;
+
+  /**
+   * @brief returns the world matrix of the parent of a node
+   */
+  const QMatrix4x4& parentWorld(int node) const;
+
+  /**
+   * @brief returns the node playing the baked clip that animates a node, or nullptr
+   */
+  const Node* playingAnimationRoot(const Node& node) const;
+
+  Object3D* root() const;
+  uint32_t hierarchyRevision() const;
+
+protected:
+  void rebuild(Object3D& root);
+
+private:
+  Object3D* m_root = nullptr;
+  uint32_t m_hierarchyRevision = 0;
+  QMatrix4x4 m_rootTransform;
+  std::vector<Node> m_nodes;
+  std::vector<Renderable> m_renderables;
+  bool m_changed = true;
+};
+
+inline bool FlatScene::changed() const
+{
+  return m_changed;
+}
+
+inline const std::vector<FlatScene::Node>& FlatScene::nodes() const
+{
+  return m_nodes;
+}
+
+inline const std::vector<FlatScene::Renderable>& FlatScene::renderables() const
+{
+  return m_renderables;
+}
+
+inline const QMatrix4x4& FlatScene::parentWorld(int node) const
+{
+  const int parent = m_nodes[node].parent;
+  return parent == -1 ? m_rootTransform : m_nodes[parent].world;
+}
+
+inline const FlatScene::Node* FlatScene::playingAnimationRoot(const Node& node) const
+{
+  if (node.animatedNode == -1)
+  {
+    return nullptr;
+  }
+
+  const Node& root = m_nodes[node.animationRoot];
+  return root.playingAnimations ? &root : nullptr;
+}
+
+inline Object3D* FlatScene::root() const
+{
+  return m_root;
+}
+
+inline uint32_t FlatScene::hierarchyRevision() const
+{
+  return m_hierarchyRevision;
+}
@@ -0,0 +1,49 @@
+// Copyright (C) 2025 Vincent Chambrin
+// This file is part of the 'mmd-viewer' project
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "renderqueue.h"
+#include "shaderinterface.h"
+
+#include <QMatrix4x4>
+
+#include <cstdint>
+#include <vector>
+
+class Object3D;
+
+/**
+ * @brief the inputs of a frame that do not come from the scene
+ */
+struct FrameParameters
+{
+  QMatrix4x4 projectionMatrix;
+  QMatrix4x4 viewMatrix;
+  bool dynamicBranching = false; ///< only affects the sort keys
+  float time = 0;                ///< see VertexAnimatedObject::currentTime()
+};
+
+/**
+ * @brief the draw list of a frame, prepared without any GL call
+ *
+ * A packet is built from a FlatScene by SceneRenderer::prepare(): the
+ * scene is culled, the items are sorted and the uniform blocks are packed.
+ * The GL thread then only has to resolve the GL objects of the items,
+ * copy the blocks and issue the draw calls.
+ *
+ * The items point into the meshes and materials owned by the FlatScene
+ * the packet was prepared from, which must not be updated before the
+ * packet is drawn.
+ */
+struct FramePacket
+{
+  Object3D* root = nullptr;
+  uint32_t hierarchyRevision = 0; ///< of 'root' when the packet was prepared
+  FrameParameters parameters;
+  RenderQueue queue;
+  shaderinterface::FrameBlock frameBlock;
+  std::vector<shaderinterface::ObjectBlock> objectBlocks; ///< one per transform of 'queue'
+  int culledNodes = 0;
+};
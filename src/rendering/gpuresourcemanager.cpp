@@ -0,0 +1,171 @@
+// Copyright (C) 2025 Vincent Chambrin
+// This file is part of the 'mmd-viewer' project
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "gpuresourcemanager.h"
+
+#include <algorithm>
+
+// number of entries checked for a dead object on each call to collectGarbage()
+constexpr int SWEEP_STEP = 16;
+
+size_t GpuResourceManager::budget() const
+{
+  return m_budget;
+}
+
+void GpuResourceManager::setBudget(size_t bytes)
+{
+  m_budget = bytes;
+}
+
+size_t GpuResourceManager::usedBytes() const
+{
+  return m_used;
+}
+
+size_t GpuResourceManager::count() const
+{
+  return m_index.size();
+}
+
+GpuResource* GpuResourceManager::find(Key key)
+{
+  auto it = m_index.find(key);
+
+  if (it == m_index.end())
+  {
+    return nullptr;
+  }
+
+  Iterator entry = it->second;
+
+  if (entry->owner.expired())
+  {
+    // the object died and a new one was allocated at the same address
+    remove(entry);
+    return nullptr;
+  }
+
+  entry->lastUsedFrame = m_frame;
+  m_lru.splice(m_lru.end(), m_lru, entry);
+
+  return entry->resource.get();
+}
+
+void GpuResourceManager::insertResource(Key key, std::weak_ptr<const void> owner, std::unique_ptr<GpuResource> resource)
+{
+  if (auto it = m_index.find(key); it != m_index.end())
+  {
+    remove(it->second);
+  }
+
+  Entry entry;
+  entry.key = key;
+  entry.owner = std::move(owner);
+  entry.bytes = resource->sizeInBytes();
+  entry.resource = std::move(resource);
+  entry.lastUsedFrame = m_frame;
+
+  m_used += entry.bytes;
+  m_lru.push_back(std::move(entry));
+  m_index[key] = std::prev(m_lru.end());
+}
+
+void GpuResourceManager::updateSize(Key key)
+{
+  auto it = m_index.find(key);
+
+  if (it != m_index.end())
+  {
+    Entry& entry = *it->second;
+    m_used -= entry.bytes;
+    entry.bytes = entry.resource->sizeInBytes();
+    m_used += entry.bytes;
+  }
+}
+
+void GpuResourceManager::beginFrame()
+{
+  ++m_frame;
+}
+
+int GpuResourceManager::collectGarbage()
+{
+  auto it = std::partition(m_retired.begin(), m_retired.end(), [](const Entry& e) { return e.resource->busy(); });
+
+  std::for_each(it, m_retired.end(), [this](const Entry& e) { m_used -= e.bytes; });
+  m_retired.erase(it, m_retired.end());
+
+  sweep(SWEEP_STEP);
+
+  return m_used > m_budget ? evict() : 0;
+}
+
+void GpuResourceManager::remove(Iterator it)
+{
+  if (it == m_sweep_cursor)
+  {
+    ++m_sweep_cursor;
+  }
+
+  m_index.erase(it->key);
+
+  if (it->resource->busy())
+  {
+    // still accounted for until the GL is done with it
+    m_retired.push_back(std::move(*it));
+  }
+  else
+  {
+    m_used -= it->bytes;
+  }
+
+  m_lru.erase(it);
+}
+
+void GpuResourceManager::sweep(int n)
+{
+  // the cursor walks the list cyclically, so that every entry is
+  // eventually checked without scanning the whole list every frame.
+  for (int i(0); i < n && !m_lru.empty(); ++i)
+  {
+    if (m_sweep_cursor == m_lru.end())
+    {
+      m_sweep_cursor = m_lru.begin();
+    }
+
+    Iterator it = m_sweep_cursor++;
+
+    if (it->owner.expired())
+    {
+      remove(it);
+    }
+  }
+}
+
+int GpuResourceManager::evict()
+{
+  int n = 0;
+
+  for (Iterator it = m_lru.begin(); it != m_lru.end() && m_used > m_budget;)
+  {
+    // entries used by the current frame are all at the back
+    if (it->lastUsedFrame == m_frame)
+    {
+      break;
+    }
+
+    Iterator next = std::next(it);
+
+    if (!it->resource->busy())
+    {
+      remove(it);
+      ++n;
+    }
+
+    it = next;
+  }
+
+  return n;
+}
@@ -0,0 +1,130 @@
+// Copyright (C) 2025 Vincent Chambrin
+// This file is part of the 'mmd-viewer' project
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief a GPU object created for a CPU-side object
+ */
+class GpuResource
+{
+public:
+  virtual ~GpuResource() = default;
+
+  /**
+   * @brief returns an estimate of the GPU memory used by the resource
+   */
+  virtual size_t sizeInBytes() const = 0;
+
+  /**
+   * @brief returns whether the GL may still be writing to the resource
+   *
+   * Busy resources are neither evicted nor deleted.
+   */
+  virtual bool busy() const { return false; }
+};
+
+/**
+ * @brief owns the GPU resources of CPU-side objects and keeps them within a memory budget
+ *
+ * Each resource is associated with the object it was created for, which
+ * is referenced weakly. Resources whose object has died are reclaimed
+ * incrementally, a few of them per frame.
+ *
+ * When the memory used exceeds the budget, the least recently used
+ * resources are evicted, except those used during the current frame.
+ * An evicted resource is simply recreated the next time its object is
+ * rendered.
+ *
+ * The OpenGL context must be current when resources are inserted,
+ * reclaimed or when the manager is destroyed.
+ */
+class GpuResourceManager
+{
+public:
+  using Key = const void*;
+
+  static constexpr size_t DEFAULT_BUDGET = size_t(256) * 1024 * 1024;
+
+  GpuResourceManager() = default;
+  GpuResourceManager(const GpuResourceManager&) = delete;
+  ~GpuResourceManager() = default;
+
+  size_t budget() const;
+  void setBudget(size_t bytes);
+
+  size_t usedBytes() const;
+  size_t count() const;
+
+  /**
+   * @brief returns the resource of an object and marks it as used by the current frame
+   *
+   * Returns nullptr if the object has no resource.
+   */
+  GpuResource* find(Key key);
+
+  template<typename T>
+  T* find(Key key)
+  {
+    return static_cast<T*>(find(key));
+  }
+
+  /**
+   * @brief adds the resource of an object, marked as used by the current frame
+   */
+  template<typename T>
+  T* insert(Key key, std::weak_ptr<const void> owner, std::unique_ptr<T> resource)
+  {
+    T* result = resource.get();
+    insertResource(key, std::move(owner), std::move(resource));
+    return result;
+  }
+
+  /**
+   * @brief updates the memory accounted for a resource after it was modified
+   */
+  void updateSize(Key key);
+
+  void beginFrame();
+
+  /**
+   * @brief reclaims some of the resources of dead objects and evicts resources until the budget is met
+   *
+   * Returns the number of resources that were evicted.
+   */
+  int collectGarbage();
+
+private:
+  struct Entry
+  {
+    Key key;
+    std::weak_ptr<const void> owner;
+    std::unique_ptr<GpuResource> resource;
+    size_t bytes = 0;
+    uint64_t lastUsedFrame = 0;
+  };
+
+  using Iterator = std::list<Entry>::iterator;
+
+  void insertResource(Key key, std::weak_ptr<const void> owner, std::unique_ptr<GpuResource> resource);
+  void remove(Iterator it);
+  void sweep(int n);
+  int evict();
+
+private:
+  size_t m_budget = DEFAULT_BUDGET;
+  size_t m_used = 0;
+  uint64_t m_frame = 1;
+  std::list<Entry> m_lru; ///< least recently used first
+  std::unordered_map<Key, Iterator> m_index;
+  Iterator m_sweep_cursor = m_lru.end();
+  std::vector<Entry> m_retired; ///< busy resources of dead objects
+};
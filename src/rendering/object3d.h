@@ -10,6 +10,7 @@
 #include <QQuaternion>
 #include <QVector3D>
 
+#include <cstdint>
 #include <memory>
 
 template<typename T>
@@ -56,6 +57,7 @@ public:
   void setScale(const QVector3D& scale);
 
   const QMatrix4x4& matrix() const;
+  uint32_t transformRevision() const;
 
   Object3D* parent() const;
   std::vector<Object3D*> children() const;
@@ -66,6 +68,10 @@ public:
   std::unique_ptr<Object3D> takeChild(const Object3D* child);
   int indexOf(const Object3D* child) const;
   void clear();
+  uint32_t hierarchyRevision() const;
+
+private:
+  void invalidateHierarchy();
 
 private:
   // visibility
@@ -75,9 +81,11 @@ private:
   EulerAngles m_rotation;
   QVector3D m_scale = QVector3D(1, 1, 1);
   mutable Lazy<QMatrix4x4> m_matrix;
+  uint32_t m_transform_revision = 0;
   // parent/children
   std::vector<std::unique_ptr<Object3D>> m_children;
   Object3D* m_parent = nullptr;
+  uint32_t m_hierarchy_revision = 0;
 };
 
 inline Object3D::Object3D()
@@ -106,6 +114,7 @@ inline void Object3D::setPosition(const QVector3D& pos)
   {
     m_position = pos;
     m_matrix.dirty = true;
+    ++m_transform_revision;
   }
 }
 
@@ -120,6 +129,7 @@ inline void Object3D::setRotation(const EulerAngles& angles)
   {
     m_rotation = angles;
     m_matrix.dirty = true;
+    ++m_transform_revision;
   }
 }
 
@@ -139,6 +149,7 @@ inline void Object3D::setScale(const QVector3D& scale)
   {
     m_scale = scale;
     m_matrix.dirty = true;
+    ++m_transform_revision;
   }
 }
 
@@ -156,6 +167,14 @@ inline const QMatrix4x4& Object3D::matrix() const
   return m_matrix.value();
 }
 
+/**
+ * @brief returns a counter that is incremented each time the local transform changes
+ */
+inline uint32_t Object3D::transformRevision() const
+{
+  return m_transform_revision;
+}
+
 inline Object3D* Object3D::parent() const
 {
   return m_parent;
@@ -197,6 +216,7 @@ inline void Object3D::add(std::unique_ptr<Object3D> child)
 
   child->m_parent = this;
   m_children.push_back(std::move(child));
+  invalidateHierarchy();
 }
 
 inline std::unique_ptr<Object3D> Object3D::takeChildAt(int index)
@@ -209,6 +229,7 @@ inline std::unique_ptr<Object3D> Object3D::takeChildAt(int index)
   std::unique_ptr<Object3D> result = std::move(m_children[index]);
   result->m_parent = nullptr;
   m_children.erase(m_children.begin() + index);
+  invalidateHierarchy();
   return result;
 }
 
@@ -229,6 +250,23 @@ inline int Object3D::indexOf(const Object3D* child) const
 inline void Object3D::clear()
 {
   m_children.clear();
+  invalidateHierarchy();
+}
+
+/**
+ * @brief returns a counter that is incremented each time a node is added or removed in the subtree
+ */
+inline uint32_t Object3D::hierarchyRevision() const
+{
+  return m_hierarchy_revision;
+}
+
+inline void Object3D::invalidateHierarchy()
+{
+  for (Object3D* node = this; node; node = node->m_parent)
+  {
+    ++node->m_hierarchy_revision;
+  }
 }
 
 class Group : public Object3D
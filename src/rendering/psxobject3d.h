@@ -8,14 +8,141 @@
 
 #include "color.h"
 
+#include "math/aabb.h"
+#include "psx/vram.h"
+
 #include <QImage>
+#include <QRect>
 
+#include <algorithm>
+#include <cstdint>
+#include <deque>
 #include <memory>
+#include <vector>
 
-struct PSX_Texture : public std::enable_shared_from_this<PSX_Texture>
+/**
+ * @brief the revisions of a texture and the regions they modified
+ *
+ * A renderer remembers the revision it last uploaded and asks for the
+ * region modified since then. The texture itself is never told about
+ * uploads, so that it can be drawn by several renderers.
+ */
+struct TextureRevisions
 {
-  QImage image;
+  static constexpr size_t MAX_HISTORY = 32; ///< older regions are forgotten
+
   int revision = 0;
+
+  void markDirty(const QRect& rect)
+  {
+    ++revision;
+    m_history.push_back(DirtyRegion{revision, rect});
+
+    if (m_history.size() > MAX_HISTORY)
+    {
+      m_history.pop_front();
+    }
+  }
+
+  /**
+   * @brief returns the union of the regions modified after a revision
+   *
+   * The result is invalid if the whole texture must be uploaded: the
+   * region of a revision was forgotten, or the revision was bumped
+   * without calling markDirty().
+   */
+  QRect dirtySince(int since) const
+  {
+    QRect result;
+    int count = 0;
+
+    for (const DirtyRegion& region : m_history)
+    {
+      if (region.revision > since)
+      {
+        result = result.united(region.rect);
+        ++count;
+      }
+    }
+
+    return count == revision - since ? result : QRect();
+  }
+
+private:
+  struct DirtyRegion
+  {
+    int revision;
+    QRect rect;
+  };
+
+  std::deque<DirtyRegion> m_history;
+};
+
+/**
+ * @brief an image used as a texture
+ *
+ * Changes to the image must be followed by a call to markDirty() so that
+ * the renderer only uploads the modified region.
+ * Bumping the revision alone causes the whole texture to be re-uploaded.
+ */
+struct PSX_Texture : public TextureRevisions, public std::enable_shared_from_this<PSX_Texture>
+{
+  QImage image;
+};
+
+/**
+ * @brief a texture page and palette of the VRAM, as addressed by a PSX primitive
+ */
+struct PSX_TextureWindow
+{
+  uint16_t texturePage = 0; ///< index of the texture page, as in TMD_TextureInfo::page
+  uint16_t bpp = 4;
+  uint16_t clutX = 0; ///< in VRAM units
+  uint16_t clutY = 0;
+
+  bool operator==(const PSX_TextureWindow&) const = default;
+};
+
+static_assert(sizeof(PSX_TextureWindow) == 8);
+
+/**
+ * @brief an emulated VRAM, shared by the materials that sample it
+ *
+ * Textures are stored as on the console: indexed texels and their
+ * palettes (CLUT) are resolved when rendering.
+ *
+ * The texture page and palette used by a vertex are given by its index
+ * in 'textureWindows', so that a single material can cover all the
+ * textures of a model.
+ */
+struct PSX_Vram : public TextureRevisions, public std::enable_shared_from_this<PSX_Vram>
+{
+  static constexpr int MAX_TEXTURE_WINDOWS = 256; ///< see PSX_Vertex::textureWindow
+
+  VRAM vram; ///< dirty regions are in VRAM units
+  std::vector<PSX_TextureWindow> textureWindows;
+
+  /**
+   * @brief returns the index of a texture window, adding it if needed
+   * @return the index, or -1 if there are already MAX_TEXTURE_WINDOWS windows
+   */
+  int textureWindowIndex(const PSX_TextureWindow& window)
+  {
+    auto it = std::find(textureWindows.begin(), textureWindows.end(), window);
+
+    if (it != textureWindows.end())
+    {
+      return int(std::distance(textureWindows.begin(), it));
+    }
+
+    if (textureWindows.size() == size_t(MAX_TEXTURE_WINDOWS))
+    {
+      return -1;
+    }
+
+    textureWindows.push_back(window);
+    return int(textureWindows.size()) - 1;
+  }
 };
 
 class PSX_Material
@@ -25,26 +152,70 @@ public:
 
   bool vertexColors = false;
   bool lighting = false;
+  bool translucent = false;
+  int blendMode = 0; // PSX semi-transparency mode, see TMD_TextureInfo::mixtureRate
   RgbColor color = RgbColor(255, 255, 255);
   std::shared_ptr<PSX_Texture> map;
+
+  // if set, the texture is sampled from the VRAM instead of 'map',
+  // using the texture window of each vertex.
+  std::shared_ptr<PSX_Vram> vram;
+};
+
+/**
+ * @brief a vertex of a PSX_Mesh, stored with the precision of the TMD format
+ *
+ * All the attributes are interleaved in 16 bytes:
+ * - the position, in TMD units;
+ * - the texture coordinates, in texels;
+ * - the normal, as a signed normalized 2_10_10_10 integer (w is unused);
+ * - the vertex color;
+ * - the index of the texture window, for materials sampling a PSX_Vram.
+ */
+struct PSX_Vertex
+{
+  int16_t position[3];
+  uint8_t uv[2];
+  uint32_t normal;
+  RgbColor color;
+  uint8_t textureWindow = 0; ///< index in PSX_Vram::textureWindows
+};
+
+static_assert(sizeof(PSX_Vertex) == 16);
+
+/**
+ * @brief the vertex data of a PSX_Object3D
+ *
+ * The mesh is shared so that the renderer can keep track of its
+ * lifetime (using a weak_ptr) and release the GPU buffers created for it.
+ */
+struct PSX_Mesh : public std::enable_shared_from_this<PSX_Mesh>
+{
+  std::vector<PSX_Vertex> vertices;
+  std::vector<uint16_t> indices;
+  std::vector<uint32_t> wideIndices; ///< replaces 'indices' when there are more than 65536 vertices
+  bool hasColors = false;
+  bool hasUV = false;
+  bool hasNormals = false;
+  AABB bounds; ///< bounding box of 'vertices', in local space
 };
 
 class PSX_Object3D : public Object3D
 {
 public:
-  std::vector<QVector3D> vertices;
-  std::vector<RgbColor> colors;
-  std::vector<QVector2D> uv;
-  std::vector<QVector3D> normals;
+  std::shared_ptr<PSX_Mesh> mesh = std::make_shared<PSX_Mesh>();
 
   std::vector<std::shared_ptr<PSX_Material>> materials;
 
   enum PrimitiveType { Line, Triangle, Quad, Sprite };
 
+  /**
+   * @brief a range of the mesh indices drawn with a single material
+   */
   struct PrimitiveInfo
   {
-    int index;
-    int count;
+    int index; ///< offset of the first index in 'mesh->indices' (or 'mesh->wideIndices')
+    int count; ///< number of indices
     PrimitiveType type;
     int materialIndex;
   };
@@ -0,0 +1,91 @@
+// Copyright (C) 2025 Vincent Chambrin
+// This file is part of the 'mmd-viewer' project
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "renderqueue.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+
+namespace renderkey
+{
+
+uint64_t translucent(float depth, uint32_t program, uint32_t texture)
+{
+  // the bit pattern of a positive float grows with its value,
+  // inverting it puts the farthest items first.
+  const uint32_t depthbits = ~std::bit_cast<uint32_t>(std::max(depth, 0.f));
+
+  return TRANSLUCENT_BIT | (uint64_t(depthbits) << 31) | (uint64_t(program & 0x7FFF) << 16)
+         | uint64_t(texture & 0xFFFF);
+}
+
+} // namespace renderkey
+
+void RenderQueue::clear()
+{
+  m_items.clear();
+  m_transforms.clear();
+  m_transform_animations.clear();
+  m_order.clear();
+}
+
+int RenderQueue::addTransform(const QMatrix4x4& m, const TransformAnimation& animation)
+{
+  m_transforms.push_back(m);
+  m_transform_animations.push_back(animation);
+  return int(m_transforms.size()) - 1;
+}
+
+void RenderQueue::push(const RenderItem& item)
+{
+  m_items.push_back(item);
+}
+
+void RenderQueue::sort()
+{
+  const size_t n = m_items.size();
+
+  m_order.resize(n);
+  m_scratch.resize(n);
+
+  std::array<std::array<uint32_t, 256>, 8> histograms = {};
+
+  for (size_t i(0); i < n; ++i)
+  {
+    const uint64_t key = m_items[i].key;
+    m_order[i] = SortEntry{key, uint32_t(i)};
+
+    for (int b(0); b < 8; ++b)
+    {
+      ++histograms[b][(key >> (8 * b)) & 0xFF];
+    }
+  }
+
+  for (int b(0); b < 8; ++b)
+  {
+    std::array<uint32_t, 256>& counts = histograms[b];
+
+    // all keys share the same byte, this pass would not change the order
+    if (n == 0 || counts[(m_order.front().key >> (8 * b)) & 0xFF] == n)
+    {
+      continue;
+    }
+
+    uint32_t offset = 0;
+    for (uint32_t& c : counts)
+    {
+      const uint32_t count = c;
+      c = offset;
+      offset += count;
+    }
+
+    for (const SortEntry& e : m_order)
+    {
+      m_scratch[counts[(e.key >> (8 * b)) & 0xFF]++] = e;
+    }
+
+    std::swap(m_order, m_scratch);
+  }
+}
@@ -0,0 +1,173 @@
+// Copyright (C) 2025 Vincent Chambrin
+// This file is part of the 'mmd-viewer' project
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "psxobject3d.h"
+
+#include <QMatrix4x4>
+
+#include <cstdint>
+#include <vector>
+
+class BakedAnimations;
+
+/**
+ * @brief helper functions for building the sort key of a RenderItem
+ *
+ * Opaque items are sorted by program, then texture, then mesh so that
+ * consecutive items share as much GL state as possible:
+ * @code
+ * [63] 0 | [62..48] program | [47..32] texture | [31..16] mesh | [15..0] unused
+ * @endcode
+ *
+ * Translucent items are drawn after all opaque items, from back to front:
+ * @code
+ * [63] 1 | [62..31] depth (far first) | [30..16] program | [15..0] texture
+ * @endcode
+ *
+ * Keys are built without GL calls, before the GL objects are known: the
+ * program is identified by its PSX_UberShader features and the texture
+ * and mesh by the address of their source (see identity()).
+ * The ids are truncated to the width of their field; a collision only
+ * affects the order of the items, not what is drawn.
+ */
+namespace renderkey
+{
+
+constexpr uint64_t TRANSLUCENT_BIT = uint64_t(1) << 63;
+
+/**
+ * @brief returns an id for an object, to be truncated in a key
+ *
+ * The low bits of an address are the same for all the objects of a type.
+ */
+inline uint32_t identity(const void* object)
+{
+  return uint32_t(reinterpret_cast<uintptr_t>(object) >> 4);
+}
+
+inline uint64_t opaque(uint32_t program, uint32_t texture, uint32_t mesh)
+{
+  return (uint64_t(program & 0x7FFF) << 48) | (uint64_t(texture & 0xFFFF) << 32)
+         | (uint64_t(mesh & 0xFFFF) << 16);
+}
+
+uint64_t translucent(float depth, uint32_t program, uint32_t texture);
+
+inline bool isTranslucent(uint64_t key)
+{
+  return key & TRANSLUCENT_BIT;
+}
+
+} // namespace renderkey
+
+/**
+ * @brief selects the baked transform of a node, see VertexAnimatedObject
+ *
+ * The model matrix of the transform is then the world matrix of the
+ * parent of the animated object.
+ */
+struct TransformAnimation
+{
+  int node = -1; ///< index of the node in the baked animations, -1 if the transform is not animated
+  int firstFrame = 0;
+  int frameCount = 0;
+  int loopStart = -1;
+  float frame = 0;
+  float timeOffset = 0;
+};
+
+/**
+ * @brief a single draw call collected from the scene
+ *
+ * Items refer to the scene data they are drawn from, the GL objects are
+ * only resolved when the item is drawn.
+ */
+struct RenderItem
+{
+  uint64_t key = 0;
+  PSX_Mesh* mesh = nullptr;
+  const PSX_Material* material = nullptr;
+  PSX_Object3D::PrimitiveInfo primitive{};
+  BakedAnimations* bakedAnimations = nullptr; ///< for animated transforms
+  int transform = -1; ///< index of the model matrix in the RenderQueue
+  int features = 0; ///< PSX_UberShader::Feature flags, selects the program
+};
+
+/**
+ * @brief collects the draw calls of a frame and sorts them by state
+ *
+ * Items are sorted with an LSD radix sort on their 64-bit key.
+ * Passes for which all the keys share the same byte are skipped, which
+ * is the common case for the unused low bits of opaque keys.
+ */
+class RenderQueue
+{
+public:
+  RenderQueue() = default;
+
+  void clear();
+
+  int addTransform(const QMatrix4x4& m, const TransformAnimation& animation = {});
+  const QMatrix4x4& transform(int index) const;
+  const TransformAnimation& transformAnimation(int index) const;
+  size_t transformCount() const;
+
+  void push(const RenderItem& item);
+
+  void sort();
+
+  size_t size() const;
+  bool empty() const;
+
+  /**
+   * @brief returns the i-th item in sorted order
+   * @note sort() must have been called after the last push()
+   */
+  const RenderItem& at(size_t i) const;
+
+private:
+  struct SortEntry
+  {
+    uint64_t key;
+    uint32_t index;
+  };
+
+  std::vector<RenderItem> m_items;
+  std::vector<QMatrix4x4> m_transforms;
+  std::vector<TransformAnimation> m_transform_animations;
+  std::vector<SortEntry> m_order;
+  std::vector<SortEntry> m_scratch;
+};
+
+inline const QMatrix4x4& RenderQueue::transform(int index) const
+{
+  return m_transforms[index];
+}
+
+inline const TransformAnimation& RenderQueue::transformAnimation(int index) const
+{
+  return m_transform_animations[index];
+}
+
+inline size_t RenderQueue::transformCount() const
+{
+  return m_transforms.size();
+}
+
+inline size_t RenderQueue::size() const
+{
+  return m_items.size();
+}
+
+inline bool RenderQueue::empty() const
+{
+  return m_items.empty();
+}
+
+inline const RenderItem& RenderQueue::at(size_t i) const
+{
+  return m_items[m_order[i].index];
+}
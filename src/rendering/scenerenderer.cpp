@@ -4,194 +4,1069 @@
 
 #include "scenerenderer.h"
 
+#include "math/frustum.h"
+
+#include <QOpenGLContext>
+#include <QOpenGLPixelTransferOptions>
+
 #include <algorithm>
+#include <cstddef>
+
+// images are uploaded as they are stored by QImage::Format_ARGB32, which
+// GL reads as BGRA with a reversed 32-bit packing on any endianness.
+// Textures are not flipped: the first row of the image is at v = 0.
+static QImage argb32(const QImage& image)
+{
+  return image.format() == QImage::Format_ARGB32 ? image : image.convertToFormat(QImage::Format_ARGB32);
+}
 
-static std::unique_ptr<QOpenGLTexture> createTextureFromImage(const QImage& image)
+static std::unique_ptr<QOpenGLTexture> allocateTexture(const PSX_Texture& psxTexture)
 {
-  auto texture = std::make_unique<QOpenGLTexture>(image.mirrored());
+  auto texture = std::make_unique<QOpenGLTexture>(QOpenGLTexture::Target2D);
+  texture->setFormat(QOpenGLTexture::RGBA8_UNorm);
+  texture->setSize(psxTexture.image.width(), psxTexture.image.height());
+  texture->setMipLevels(texture->maximumMipLevels());
   texture->setWrapMode(QOpenGLTexture::ClampToEdge);
+  texture->allocateStorage(QOpenGLTexture::BGRA, QOpenGLTexture::UInt32_RGBA8_Rev);
   return texture;
 }
 
-QOpenGLTexture* OpenGLTextureManager::getTextureFor(PSX_Texture& psxTexture)
+static std::unique_ptr<QOpenGLTexture> allocateTexture(const PSX_Vram& psxVram)
+{
+  // texels are fetched with texelFetch() and decoded in the shader
+  auto texture = std::make_unique<QOpenGLTexture>(QOpenGLTexture::Target2D);
+  texture->setFormat(QOpenGLTexture::R16U);
+  texture->setSize(VRAM::WIDTH, VRAM::HEIGHT);
+  texture->setMipLevels(1);
+  texture->setMinMagFilters(QOpenGLTexture::Nearest, QOpenGLTexture::Nearest);
+  texture->allocateStorage(QOpenGLTexture::Red_Integer, QOpenGLTexture::UInt16);
+  return texture;
+}
+
+static void uploadTexture(QOpenGLTexture& texture, const PSX_Texture& psxTexture)
+{
+  const QImage image = argb32(psxTexture.image);
+  texture.setData(QOpenGLTexture::BGRA, QOpenGLTexture::UInt32_RGBA8_Rev, image.constBits());
+  texture.generateMipMaps();
+}
+
+static void uploadTexture(QOpenGLTexture& texture, const PSX_Vram& psxVram)
+{
+  texture.setData(QOpenGLTexture::Red_Integer, QOpenGLTexture::UInt16, psxVram.vram.data.data());
+}
+
+static TextureUpload makeUpload(QOpenGLTexture& texture, const PSX_Texture& psxTexture)
+{
+  // the QImage is implicitly shared: this does not copy the pixels, and
+  // later changes to the texture's image detach from this copy.
+  auto image = std::make_shared<const QImage>(argb32(psxTexture.image));
+
+  TextureUpload upload;
+  upload.texture = texture.textureId();
+  upload.size = image->size();
+  upload.format = GL_BGRA;
+  upload.type = GL_UNSIGNED_INT_8_8_8_8_REV;
+  upload.alignment = 4;
+  upload.generateMipMaps = true;
+  upload.pixels = image->constBits();
+  upload.sizeInBytes = size_t(image->sizeInBytes());
+  upload.owner = std::move(image);
+  return upload;
+}
+
+static TextureUpload makeUpload(QOpenGLTexture& texture, const PSX_Vram& psxVram)
+{
+  // the VRAM is modified in place by animations, a copy is uploaded
+  auto vram = std::make_shared<const VRAM>(psxVram.vram);
+
+  TextureUpload upload;
+  upload.texture = texture.textureId();
+  upload.size = QSize(VRAM::WIDTH, VRAM::HEIGHT);
+  upload.format = GL_RED_INTEGER;
+  upload.type = GL_UNSIGNED_SHORT;
+  upload.alignment = 2;
+  upload.pixels = vram->data.data();
+  upload.sizeInBytes = sizeof(vram->data);
+  upload.owner = std::move(vram);
+  return upload;
+}
+
+static void updateTexture(QOpenGLTexture& texture, const PSX_Texture& psxTexture, QRect rect)
+{
+  const QImage image = argb32(psxTexture.image);
+  rect = rect.intersected(image.rect());
+
+  if (rect.isEmpty())
+  {
+    return;
+  }
+
+  // upload directly from the image, the row length skips the rest of each line
+  QOpenGLPixelTransferOptions options;
+  options.setRowLength(int(image.bytesPerLine() / sizeof(uint32_t)));
+  options.setAlignment(4);
+
+  const uchar* pixels = image.constScanLine(rect.y()) + rect.x() * sizeof(uint32_t);
+
+  texture.setData(rect.x(),
+                  rect.y(),
+                  0,
+                  rect.width(),
+                  rect.height(),
+                  1,
+                  QOpenGLTexture::BGRA,
+                  QOpenGLTexture::UInt32_RGBA8_Rev,
+                  pixels,
+                  &options);
+
+  if (texture.mipLevels() > 1)
+  {
+    texture.generateMipMaps();
+  }
+}
+
+static void updateTexture(QOpenGLTexture& texture, const PSX_Vram& psxVram, QRect rect)
+{
+  rect = rect.intersected(QRect(0, 0, VRAM::WIDTH, VRAM::HEIGHT));
+
+  if (rect.isEmpty())
+  {
+    return;
+  }
+
+  // upload directly from the VRAM, the row length skips the rest of each line
+  QOpenGLPixelTransferOptions options;
+  options.setRowLength(VRAM::WIDTH);
+  options.setAlignment(2);
+
+  const uint16_t* pixels = psxVram.vram.data.data() + rect.y() * VRAM::WIDTH + rect.x();
+
+  texture.setData(rect.x(),
+                  rect.y(),
+                  0,
+                  rect.width(),
+                  rect.height(),
+                  1,
+                  QOpenGLTexture::Red_Integer,
+                  QOpenGLTexture::UInt16,
+                  pixels,
+                  &options);
+}
+
+static size_t textureSizeInBytes(const PSX_Texture& psxTexture)
+{
+  // the mipmap chain adds a third to the size of the image
+  const size_t bytes = size_t(psxTexture.image.width()) * psxTexture.image.height() * sizeof(uint32_t);
+  return bytes + bytes / 3;
+}
+
+static size_t textureSizeInBytes(const PSX_Vram& psxVram)
+{
+  return sizeof(psxVram.vram.data);
+}
+
+size_t OpenGLTextureManager::Value::sizeInBytes() const
+{
+  return textureBytes + textureWindowCount * sizeof(PSX_TextureWindow);
+}
+
+OpenGLTextureManager::OpenGLTextureManager(GpuResourceManager& resources)
+    : m_resources(resources)
+{}
+
+OpenGLTextureManager::~OpenGLTextureManager()
 {
-  auto it = m_textures.find(&psxTexture);
-  if (it != m_textures.end())
+  if (m_uploader)
+  {
+    // no upload completes after this, the fences of those not collected yet are deleted below
+    m_uploader->stop();
+
+    std::vector<CompletedTextureUpload> uploads = m_uploader->takeCompletedUploads();
+    m_completed_uploads.insert(m_completed_uploads.end(), uploads.begin(), uploads.end());
+  }
+
+  if (QOpenGLContext* context = QOpenGLContext::currentContext())
+  {
+    for (const CompletedTextureUpload& upload : m_completed_uploads)
+    {
+      context->extraFunctions()->glDeleteSync(upload.done);
+    }
+  }
+}
+
+void OpenGLTextureManager::setUploader(TextureUploader* uploader)
+{
+  m_uploader = uploader && uploader->isValid() ? uploader : nullptr;
+}
+
+template<typename T>
+void OpenGLTextureManager::createTexture(Value& value, const T& source)
+{
+  value.texture = allocateTexture(source);
+  value.textureBytes = textureSizeInBytes(source);
+
+  if (!m_uploader)
+  {
+    uploadTexture(*value.texture, source);
+    return;
+  }
+
+  QOpenGLExtraFunctions* gl = QOpenGLContext::currentContext()->extraFunctions();
+
+  TextureUpload upload = makeUpload(*value.texture, source);
+
+  // the upload context waits for the storage to be allocated
+  upload.allocated = gl->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  gl->glFlush();
+
+  m_uploads[value.texture->textureId()] = &value;
+  m_uploader->upload(std::move(upload));
+  value.uploading = true;
+}
+
+template<typename T>
+OpenGLTextureManager::Value* OpenGLTextureManager::getValue(T& source)
+{
+  Value* value = m_resources.find<Value>(&source);
+
+  if (!value)
+  {
+    auto resource = std::make_unique<Value>();
+    createTexture(*resource, source);
+    resource->revision = source.revision;
+    return m_resources.insert(&source, source.shared_from_this(), std::move(resource));
+  }
+
+  if (value->uploading)
   {
-    Value& value = it->second;
-    if (value.revision != psxTexture.revision)
+    // changes made in the meantime are applied once the upload completes
+    return value;
+  }
+
+  if (value->revision != source.revision)
+  {
+    // the source is not modified, other renderers may be behind this one
+    const QRect dirty = source.dirtySince(value->revision);
+
+    if (dirty.isValid())
+    {
+      updateTexture(*value->texture, source, dirty);
+    }
+    else
     {
-      value.texture = createTextureFromImage(psxTexture.image);
-      value.revision = psxTexture.revision;
+      createTexture(*value, source);
+      m_resources.updateSize(&source);
     }
-    return value.texture.get();
+
+    value->revision = source.revision;
+  }
+
+  return value;
+}
+
+QOpenGLTexture* OpenGLTextureManager::placeholderFor(const PSX_Texture& /* psxTexture */)
+{
+  if (!m_placeholder)
+  {
+    const uint32_t white = 0xFFFFFFFF;
+    m_placeholder = std::make_unique<QOpenGLTexture>(QOpenGLTexture::Target2D);
+    m_placeholder->setFormat(QOpenGLTexture::RGBA8_UNorm);
+    m_placeholder->setSize(1, 1);
+    m_placeholder->setMipLevels(1);
+    m_placeholder->allocateStorage(QOpenGLTexture::BGRA, QOpenGLTexture::UInt32_RGBA8_Rev);
+    m_placeholder->setData(QOpenGLTexture::BGRA, QOpenGLTexture::UInt32_RGBA8_Rev, &white);
   }
 
-  PSX_Texture_Entry e;
-  e.key = &psxTexture;
-  e.weakptr = psxTexture.shared_from_this();
-  m_entries.push_back(e);
+  return m_placeholder.get();
+}
+
+QOpenGLTexture* OpenGLTextureManager::placeholderFor(const PSX_Vram& /* psxVram */)
+{
+  // texels of the VRAM are decoded by the shader, the items are not drawn instead
+  return nullptr;
+}
 
-  Value& value = m_textures[&psxTexture];
-  value.texture = createTextureFromImage(psxTexture.image);
-  value.revision = psxTexture.revision;
-  return value.texture.get();
+QOpenGLTexture* OpenGLTextureManager::getTextureFor(PSX_Texture& psxTexture)
+{
+  Value* value = getValue(psxTexture);
+  return value->uploading ? placeholderFor(psxTexture) : value->texture.get();
+}
+
+QOpenGLTexture* OpenGLTextureManager::getTextureFor(PSX_Vram& psxVram)
+{
+  Value* value = getValue(psxVram);
+  return value->uploading ? placeholderFor(psxVram) : value->texture.get();
 }
 
-void OpenGLTextureManager::deleteUnreachableTextures()
+void OpenGLTextureManager::processCompletedUploads()
 {
-  auto it = std::partition(m_entries.begin(), m_entries.end(), [](const PSX_Texture_Entry& e) {
-    return !e.weakptr.expired();
+  if (!m_uploader)
+  {
+    return;
+  }
+
+  std::vector<CompletedTextureUpload> uploads = m_uploader->takeCompletedUploads();
+  m_completed_uploads.insert(m_completed_uploads.end(), uploads.begin(), uploads.end());
+
+  if (m_completed_uploads.empty())
+  {
+    return;
+  }
+
+  QOpenGLExtraFunctions* gl = QOpenGLContext::currentContext()->extraFunctions();
+
+  // uploads still being processed by the GL stay at the front
+  auto it = std::partition(m_completed_uploads.begin(),
+                           m_completed_uploads.end(),
+                           [gl](const CompletedTextureUpload& upload) {
+                             return gl->glClientWaitSync(upload.done, 0, 0) == GL_TIMEOUT_EXPIRED;
+                           });
+
+  std::for_each(it, m_completed_uploads.end(), [this, gl](const CompletedTextureUpload& upload) {
+    gl->glDeleteSync(upload.done);
+
+    // the value may belong to a dead object, the resource manager then deletes it
+    if (auto value = m_uploads.find(upload.texture); value != m_uploads.end())
+    {
+      value->second->uploading = false;
+      m_uploads.erase(value);
+    }
   });
 
-  std::for_each(it, m_entries.end(), [this](PSX_Texture_Entry& e) { m_textures.erase(e.key); });
+  m_completed_uploads.erase(it, m_completed_uploads.end());
+}
+
+QOpenGLTexture* OpenGLTextureManager::getTextureWindowsFor(PSX_Vram& psxVram)
+{
+  Value& value = *getValue(psxVram);
+
+  const std::vector<PSX_TextureWindow>& windows = psxVram.textureWindows;
+
+  // windows are only ever appended, by the model converter
+  if (value.textureWindowCount != windows.size())
+  {
+    value.textureWindows.reset();
+    value.textureWindowCount = windows.size();
+
+    if (!windows.empty())
+    {
+      auto texture = std::make_unique<QOpenGLTexture>(QOpenGLTexture::Target2D);
+      texture->setFormat(QOpenGLTexture::RGBA16U);
+      texture->setSize(int(windows.size()), 1);
+      texture->setMipLevels(1);
+      texture->setMinMagFilters(QOpenGLTexture::Nearest, QOpenGLTexture::Nearest);
+      texture->allocateStorage(QOpenGLTexture::RGBA_Integer, QOpenGLTexture::UInt16);
+      texture->setData(QOpenGLTexture::RGBA_Integer, QOpenGLTexture::UInt16, windows.data());
+      value.textureWindows = std::move(texture);
+    }
+
+    m_resources.updateSize(&psxVram);
+  }
 
-  m_entries.erase(it, m_entries.end());
+  return value.textureWindows.get();
 }
 
-bool SceneRenderer::setupVAOAndVBO()
+QOpenGLTexture* OpenGLTextureManager::getTextureFor(BakedAnimations& animations)
 {
-  if (!m_vao.create())
+  auto* value = m_resources.find<BakedAnimationsValue>(&animations);
+
+  if (value && value->frameCount == animations.frameCount)
   {
-    return false;
+    return value->texture.get();
+  }
+
+  if (animations.frameCount == 0)
+  {
+    return nullptr;
+  }
+
+  GLint max_texture_size = 0;
+  QOpenGLContext::currentContext()->functions()->glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture_size);
+
+  if (!animations.fitsInTexture(max_texture_size))
+  {
+    // the storage could not be allocated, the caller should have played the clips on the CPU
+    return nullptr;
   }
 
-  m_vao.bind();
+  auto texture = std::make_unique<QOpenGLTexture>(QOpenGLTexture::Target2D);
+  texture->setFormat(QOpenGLTexture::RGBA32F);
+  texture->setSize(animations.width(), animations.frameCount);
+  texture->setMipLevels(1);
+  texture->setMinMagFilters(QOpenGLTexture::Nearest, QOpenGLTexture::Nearest);
+  texture->allocateStorage(QOpenGLTexture::RGBA, QOpenGLTexture::Float32);
+  texture->setData(QOpenGLTexture::RGBA, QOpenGLTexture::Float32, animations.texels.data());
+
+  auto resource = std::make_unique<BakedAnimationsValue>();
+  resource->frameCount = animations.frameCount;
+  resource->texture = std::move(texture);
+  resource->bytes = animations.sizeInBytes();
+  return m_resources.insert(&animations, animations.shared_from_this(), std::move(resource))->texture.get();
+}
+
+static std::unique_ptr<OpenGLMesh> createMesh(const PSX_Mesh& mesh, QOpenGLFunctions* gl)
+{
+  auto result = std::make_unique<OpenGLMesh>();
+
+  if (!result->vao.create())
+  {
+    return nullptr;
+  }
+
+  result->vao.bind();
 
   // fill buffers and init vao
   {
+    constexpr GLsizei stride = sizeof(PSX_Vertex);
+    auto offset = [](size_t n) { return reinterpret_cast<const GLvoid*>(n); };
+
     {
-      BufferSpecs specs = BufferSpecsBuilder().index(0).tuplesize(3).type(GL_FLOAT);
-      setup_buffer(m_buffers.vertex, this, BufferData(), specs);
+      BufferSpecs specs = BufferSpecsBuilder().index(0).tuplesize(3).type(GL_SHORT).stride(stride).offset(
+        offset(offsetof(PSX_Vertex, position)));
+      setup_buffer(result->buffers.vertex, gl, buffer_data_from_vector(mesh.vertices), specs);
     }
 
+    QOpenGLBuffer& vbo = *result->buffers.vertex;
+
+    if (mesh.hasColors)
+    {
+      BufferSpecs specs = BufferSpecsBuilder().index(2).tuplesize(3).type(GL_UNSIGNED_BYTE).stride(stride).offset(
+        offset(offsetof(PSX_Vertex, color)));
+      setup_attribute(vbo, gl, specs);
+    }
+
+    if (mesh.hasUV)
     {
-      BufferSpecs specs = BufferSpecsBuilder().index(2).tuplesize(3).type(GL_UNSIGNED_BYTE);
-      setup_buffer(m_buffers.color, this, BufferData(), specs);
+      BufferSpecs specs = BufferSpecsBuilder().index(3).tuplesize(2).type(GL_UNSIGNED_BYTE).stride(stride).offset(
+        offset(offsetof(PSX_Vertex, uv)));
+      setup_attribute(vbo, gl, specs);
+
+      specs = BufferSpecsBuilder().index(5).tuplesize(1).type(GL_UNSIGNED_BYTE).stride(stride).offset(
+        offset(offsetof(PSX_Vertex, textureWindow)));
+      setup_attribute(vbo, gl, specs);
     }
 
+    if (mesh.hasNormals)
     {
-      BufferSpecs specs = BufferSpecsBuilder().index(3).tuplesize(2).type(GL_FLOAT);
-      setup_buffer(m_buffers.uv, this, BufferData(), specs);
+      BufferSpecs specs = BufferSpecsBuilder()
+                            .index(4)
+                            .tuplesize(4)
+                            .type(GL_INT_2_10_10_10_REV)
+                            .normalized(GL_TRUE)
+                            .stride(stride)
+                            .offset(offset(offsetof(PSX_Vertex, normal)));
+      setup_attribute(vbo, gl, specs);
     }
 
+    // the element array binding is part of the vao state
+    if (!mesh.wideIndices.empty())
     {
-      BufferSpecs specs = BufferSpecsBuilder().index(4).tuplesize(3).type(GL_FLOAT);
-      setup_buffer(m_buffers.normal, this, BufferData(), specs);
+      setup_index_buffer(result->buffers.index, gl, buffer_data_from_vector(mesh.wideIndices));
+      result->indexType = GL_UNSIGNED_INT;
+    }
+    else
+    {
+      setup_index_buffer(result->buffers.index, gl, buffer_data_from_vector(mesh.indices));
     }
   }
 
-  return true;
+  result->bytes = mesh.vertices.size() * sizeof(PSX_Vertex) + mesh.indices.size() * sizeof(uint16_t)
+                  + mesh.wideIndices.size() * sizeof(uint32_t);
+
+  result->vao.release();
+
+  return result;
 }
 
-void SceneRenderer::recursiveRender(Object3D& object, QMatrix4x4 modelTransform)
+OpenGLMeshManager::OpenGLMeshManager(GpuResourceManager& resources)
+    : m_resources(resources)
+{}
+
+OpenGLMesh* OpenGLMeshManager::getMeshFor(PSX_Mesh& psxMesh, QOpenGLFunctions* gl)
 {
-  modelTransform *= object.matrix();
+  if (OpenGLMesh* mesh = m_resources.find<OpenGLMesh>(&psxMesh))
+  {
+    return mesh;
+  }
+
+  std::unique_ptr<OpenGLMesh> mesh = createMesh(psxMesh, gl);
 
-  if (auto* psxobj = dynamic_cast<PSX_Object3D*>(&object))
+  if (!mesh)
   {
-    render(*psxobj, modelTransform);
+    return nullptr;
   }
 
-  for (Object3D* child : object.children())
+  return m_resources.insert(&psxMesh, psxMesh.shared_from_this(), std::move(mesh));
+}
+
+using namespace shaderinterface;
+
+PSX_UberShader::Uniforms PSX_UberShader::setupProgram(QOpenGLShaderProgram& program)
+{
+  QOpenGLExtraFunctions* gl = QOpenGLContext::currentContext()->extraFunctions();
+  const GLuint id = program.programId();
+
+  auto bind_block = [gl, id](const char* name, GLuint binding) {
+    const GLuint index = gl->glGetUniformBlockIndex(id, name);
+
+    if (index != GL_INVALID_INDEX)
+    {
+      gl->glUniformBlockBinding(id, index, binding);
+    }
+  };
+
+  bind_block("FrameBlock", FRAME_BLOCK_BINDING);
+  bind_block("ObjectBlock", OBJECT_BLOCK_BINDING);
+
+  program.bind();
+  program.setUniformValue("texture_diffuse", int(TEXTURE_DIFFUSE_UNIT));
+  program.setUniformValue("texture_windows", int(TEXTURE_WINDOWS_UNIT));
+  program.setUniformValue("vram", int(VRAM_TEXTURE_UNIT));
+  program.setUniformValue("baked_animations", int(BAKED_ANIMATIONS_UNIT));
+  program.release();
+
+  Uniforms uniforms;
+  uniforms.materialColor = program.uniformLocation("material_color");
+  uniforms.features = program.uniformLocation("features");
+  return uniforms;
+}
+
+SceneRenderer::SceneRenderer(QOpenGLContext* ctx)
+    : QOpenGLFunctions(ctx)
+    , m_context(ctx)
+    , m_uploader(std::make_unique<TextureUploader>(ctx))
+    , m_textures(m_resources)
+    , m_meshes(m_resources)
+{
+  m_textures.setUploader(m_uploader.get());
+
+  glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &m_uniform_alignment);
+  m_uniform_alignment = std::max(m_uniform_alignment, 1);
+  m_object_block_stride = (GLint(sizeof(ObjectBlock)) + m_uniform_alignment - 1) / m_uniform_alignment
+                          * m_uniform_alignment;
+
+  m_uniform_stream = std::make_unique<StreamingBuffer>(ctx->extraFunctions(), GL_UNIFORM_BUFFER, 64 * 1024);
+
+  glGetIntegerv(GL_MAX_TEXTURE_SIZE, &m_max_texture_size);
+
+  m_shaders.setDynamicBranching(qEnvironmentVariableIntValue("MMDVIEWER_DYNAMIC_BRANCHING") == 1);
+  m_shaders.compileAllPrograms();
+
+  if (qEnvironmentVariableIsSet("MMDVIEWER_SHADER_BENCHMARK"))
   {
-    recursiveRender(*child, modelTransform);
+    m_benchmark = std::make_unique<ShaderModeBenchmark>();
   }
+
+  m_pipelined = qEnvironmentVariableIntValue("MMDVIEWER_PIPELINED_RENDERING") == 1;
 }
 
-void SceneRenderer::render(PSX_Object3D& object, const QMatrix4x4& modelTransform)
+SceneRenderer::~SceneRenderer()
 {
-  if (object.vertices.empty())
+  // the job refers to the scenes and packets
+  if (m_prepare_job)
   {
-    return;
+    JobSystem::instance().wait(m_prepare_job);
   }
+}
 
-  if (!m_vao.isCreated())
+bool SceneRenderer::dynamicBranching() const
+{
+  return m_shaders.dynamicBranching();
+}
+
+void SceneRenderer::setDynamicBranching(bool on)
+{
+  m_shaders.setDynamicBranching(on);
+  m_shaders.compileAllPrograms();
+}
+
+void SceneRenderer::render(Object3D& model)
+{
+  glEnable(GL_CULL_FACE);
+
+  QMatrix4x4 model_matrix;
+  {
+    // TMD y-down/z-depth, so we need to apply a transform to be z-up.
+    model_matrix(1, 1) = 0;
+    model_matrix(2, 2) = 0;
+    model_matrix(0, 0) = 1;
+    model_matrix(1, 2) = 1;
+    model_matrix(2, 1) = -1;
+  }
+
+  m_stats = RenderStats();
+
+  if (m_benchmark)
   {
-    if (!setupVAOAndVBO())
+    m_benchmark->beginFrame(dynamicBranching());
+  }
+
+  // the packet of the previous frame, if it was prepared in the background
+  const FramePacket* previous = nullptr;
+
+  if (m_prepare_job)
+  {
+    JobSystem::instance().wait(m_prepare_job);
+    m_prepare_job.reset();
+
+    const FramePacket& packet = m_packets[m_prepared];
+
+    // the packet still owns the meshes and materials of removed objects, but
+    // it would show them for one more frame
+    if (packet.root == &model && packet.hierarchyRevision == model.hierarchyRevision())
     {
-      qDebug() << "could no create vao";
-      return;
+      previous = &packet;
     }
   }
+
+  // a packet is never prepared while it is drawn, nor while its scene is updated
+  const int next = m_prepared == 0 ? 1 : 0;
+  FlatScene& scene = m_scenes[next];
+  FramePacket& packet = m_packets[next];
+  m_prepared = next;
+
+  // everything the preparation reads from the scene is copied here
+  scene.update(model, model_matrix);
+
+  FrameParameters parameters;
+  parameters.projectionMatrix = projectionMatrix;
+  parameters.viewMatrix = viewMatrix;
+  parameters.dynamicBranching = dynamicBranching();
+  parameters.time = VertexAnimatedObject::currentTime();
+
+  const FramePacket* drawn = &packet;
+
+  if (m_pipelined && previous)
+  {
+    m_prepare_job = JobSystem::instance().submit([&packet, &scene, parameters]() {
+      prepare(packet, scene, parameters);
+    });
+
+    m_frame_pending = scene.changed() || parameters.projectionMatrix != previous->parameters.projectionMatrix
+                      || parameters.viewMatrix != previous->parameters.viewMatrix;
+    drawn = previous;
+  }
   else
   {
-    m_vao.bind();
+    // the first frame, or the previous packet is not valid anymore
+    prepare(packet, scene, parameters);
+
+    if (m_pipelined)
+    {
+      // the next frame draws this packet again while it prepares its own
+      m_prepare_job = JobSystem::instance().submit([]() {});
+    }
+
+    m_frame_pending = false;
+  }
+
+  m_resources.beginFrame();
+  m_textures.processCompletedUploads();
+  m_stats.culledNodes = drawn->culledNodes;
+
+  if (writeUniformBlocks(*drawn))
+  {
+    draw(*drawn);
+  }
+
+  // fences the uniform blocks after the draws that read them
+  m_uniform_stream->endFrame();
+
+  if (m_benchmark && m_benchmark->endFrame(m_stats))
+  {
+    setDynamicBranching(!dynamicBranching());
   }
 
-  //update buffers
+  // resources used by this frame are not evicted
+  m_stats.evictedResources = m_resources.collectGarbage();
+}
+
+void SceneRenderer::prepare(FramePacket& packet, const FlatScene& scene, const FrameParameters& parameters)
+{
+  packet.root = scene.root();
+  packet.hierarchyRevision = scene.hierarchyRevision();
+  packet.parameters = parameters;
+  packet.culledNodes = 0;
+  packet.queue.clear();
+
+  collect(packet, scene);
+  packet.queue.sort();
+  packUniformBlocks(packet);
+}
+
+void SceneRenderer::collect(FramePacket& packet, const FlatScene& scene)
+{
+  const Frustum frustum{packet.parameters.projectionMatrix * packet.parameters.viewMatrix};
+  const std::vector<FlatScene::Node>& nodes = scene.nodes();
+
+  for (int i(0); i < int(nodes.size());)
   {
+    const FlatScene::Node& node = nodes[i];
+
+    if (!frustum.intersects(node.subtreeBounds))
     {
-      update_buffer(m_buffers.vertex, buffer_data_from_vector(object.vertices));
+      // the node and all its descendants are off-screen
+      packet.culledNodes += node.subtreeEnd - i;
+      i = node.subtreeEnd;
+      continue;
     }
 
-    if (!object.colors.empty())
+    if (node.mesh)
     {
-      update_buffer(m_buffers.color, buffer_data_from_vector(object.colors));
+      const FlatScene::Node* root = scene.playingAnimationRoot(node);
+
+      if (!frustum.intersects(node.bounds))
+      {
+        ++packet.culledNodes;
+      }
+      else if (root)
+      {
+        const BakedAnimations::Clip& clip = root->playingClip;
+
+        TransformAnimation animation;
+        animation.node = node.animatedNode;
+        animation.firstFrame = clip.firstFrame;
+        animation.frameCount = clip.frameCount;
+        animation.loopStart = clip.loopStart;
+        animation.frame = root->playback.frame;
+        animation.timeOffset = root->playback.timeOffset;
+
+        // the node's own transforms are replaced by the baked ones
+        enqueue(packet,
+                node,
+                scene.parentWorld(node.animationRoot),
+                node.bounds,
+                animation,
+                root->playingAnimations.get());
+      }
+      else
+      {
+        enqueue(packet, node, node.world, node.bounds);
+      }
     }
 
-    if (!object.uv.empty())
+    ++i;
+  }
+}
+
+void SceneRenderer::enqueue(FramePacket& packet,
+                            const FlatScene::Node& node,
+                            const QMatrix4x4& modelTransform,
+                            const AABB& worldBounds,
+                            const TransformAnimation& animation,
+                            BakedAnimations* bakedAnimations)
+{
+  PSX_Mesh& mesh = *node.mesh;
+  RenderQueue& queue = packet.queue;
+
+  const int transform = queue.addTransform(modelTransform, animation);
+  const float depth = -(packet.parameters.viewMatrix * QVector4D(worldBounds.center(), 1)).z();
+  const uint32_t mesh_id = renderkey::identity(&mesh);
+
+  for (const PSX_Object3D::PrimitiveInfo& primitive : node.primitives)
+  {
+    if (primitive.type == PSX_Object3D::Sprite)
     {
-      update_buffer(m_buffers.uv, buffer_data_from_vector(object.uv));
+      // TODO: handle sprites
+      continue;
     }
 
-    if (!object.normals.empty())
+    const PSX_Material& material = *node.materials[primitive.materialIndex];
+
+    RenderItem item;
+    item.features = PSX_UberShader::features(PSX_UberShader::config(mesh, material));
+    item.mesh = &mesh;
+    item.material = &material;
+    item.primitive = primitive;
+    item.transform = transform;
+    item.bakedAnimations = bakedAnimations;
+
+    // a single program is used with dynamic branching
+    const uint32_t program_id = packet.parameters.dynamicBranching ? 0 : uint32_t(item.features);
+    const void* texture = material.map ? static_cast<const void*>(material.map.get())
+                                       : static_cast<const void*>(material.vram.get());
+    const uint32_t texture_id = texture ? renderkey::identity(texture) : 0;
+
+    if (material.translucent)
+    {
+      item.key = renderkey::translucent(depth, program_id, texture_id);
+    }
+    else
     {
-      update_buffer(m_buffers.normal, buffer_data_from_vector(object.normals));
+      item.key = renderkey::opaque(program_id, texture_id, mesh_id);
     }
+
+    queue.push(item);
   }
+}
+
+void SceneRenderer::packUniformBlocks(FramePacket& packet)
+{
+  const FrameParameters& parameters = packet.parameters;
+
+  FrameBlock& frame = packet.frameBlock;
+  write(frame.viewMatrix, parameters.viewMatrix);
+  write(frame.projectionMatrix, parameters.projectionMatrix);
+  write(frame.lightDirection, QVector3D(-1, 1, -1));
+  write(frame.lightAmbient, QVector3D(0.7, 0.7, 0.7));
+  write(frame.lightDiffuse, QVector3D(0.3, 0.3, 0.3));
+  frame.time = parameters.time;
+
+  const RenderQueue& queue = packet.queue;
+  packet.objectBlocks.resize(queue.transformCount());
+
+  for (size_t i(0); i < queue.transformCount(); ++i)
+  {
+    ObjectBlock& block = packet.objectBlocks[i];
+    block = objectBlock(queue.transform(int(i)));
+    const TransformAnimation& animation = queue.transformAnimation(int(i));
+
+    if (animation.node != -1)
+    {
+      block.animation[0] = animation.node;
+      block.animation[1] = animation.firstFrame;
+      block.animation[2] = animation.frameCount;
+      block.animation[3] = animation.loopStart;
+      block.animationTime[0] = animation.frame;
+      block.animationTime[1] = animation.timeOffset;
+    }
+  }
+}
+
+bool SceneRenderer::writeUniformBlocks(const FramePacket& packet)
+{
+  const size_t n = packet.objectBlocks.size();
+  const GLsizeiptr frame_block_size = (GLsizeiptr(sizeof(FrameBlock)) + m_uniform_alignment - 1)
+                                      / m_uniform_alignment * m_uniform_alignment;
+  m_uniform_stream->reserve(frame_block_size + GLsizeiptr(n) * m_object_block_stride);
+
+  m_uniform_stream->beginFrame();
+
+  StreamingBuffer::Allocation frame = m_uniform_stream->allocate(sizeof(FrameBlock), m_uniform_alignment);
+  StreamingBuffer::Allocation objects = m_uniform_stream->allocate(GLsizeiptr(n) * m_object_block_stride,
+                                                                   m_uniform_alignment);
+
+  if (frame)
+  {
+    std::memcpy(frame.ptr, &packet.frameBlock, sizeof(FrameBlock));
+  }
+
+  if (objects)
+  {
+    // the blocks of all transforms are written at once, and then selected
+    // with glBindBufferRange() when drawing
+    auto* dest = static_cast<std::byte*>(objects.ptr);
+
+    for (size_t i(0); i < n; ++i)
+    {
+      std::memcpy(dest + i * m_object_block_stride, &packet.objectBlocks[i], sizeof(ObjectBlock));
+    }
+
+    m_object_blocks_offset = objects.offset;
+  }
+
+  m_uniform_stream->unmap();
+
+  if (!frame || (n > 0 && !objects))
+  {
+    qDebug() << "could not map the uniform buffer";
+    return false;
+  }
+
+  m_context->extraFunctions()->glBindBufferRange(GL_UNIFORM_BUFFER,
+                                                 FRAME_BLOCK_BINDING,
+                                                 m_uniform_stream->bufferId(),
+                                                 frame.offset,
+                                                 sizeof(FrameBlock));
+
+  return true;
+}
+
+void SceneRenderer::draw(const FramePacket& packet)
+{
+  const RenderQueue& queue = packet.queue;
+  RenderStats& stats = m_stats;
+
+  QOpenGLExtraFunctions* gl = m_context->extraFunctions();
 
   QOpenGLShaderProgram* active_program = nullptr;
+  const PSX_UberShader::Uniforms* active_uniforms = nullptr;
+  const bool dynamic_branching = m_shaders.dynamicBranching();
+
+  QOpenGLTexture* active_texture = nullptr;
+  QOpenGLTexture* active_vram = nullptr;
+  QOpenGLTexture* active_texture_windows = nullptr;
+  QOpenGLTexture* active_baked_animations = nullptr;
+  OpenGLMesh* active_mesh = nullptr;
+  int active_transform = -1;
+  int active_blend_mode = -1;
+  int active_features = -1;
 
-  for (const PSX_Object3D::PrimitiveInfo& primitive : object.primitives)
+  // the GL objects of the previous item, consecutive items mostly share them
+  const PSX_Mesh* resolved_mesh_source = nullptr;
+  OpenGLMesh* resolved_mesh = nullptr;
+  int resolved_features = -1;
+  QOpenGLShaderProgram* resolved_program = nullptr;
+  const PSX_Material* resolved_material = nullptr;
+  QOpenGLTexture* resolved_texture = nullptr;
+  QOpenGLTexture* resolved_texture_windows = nullptr;
+  const BakedAnimations* resolved_baked_animations_source = nullptr;
+  QOpenGLTexture* resolved_baked_animations = nullptr;
+
+  for (size_t i(0); i < queue.size(); ++i)
   {
-    if (primitive.type == PSX_Object3D::Sprite)
+    const RenderItem& item = queue.at(i);
+    const PSX_Material& material = *item.material;
+
+    if (item.mesh != resolved_mesh_source)
     {
-      // TODO: handle sprites
+      resolved_mesh_source = item.mesh;
+      resolved_mesh = m_meshes.getMeshFor(*item.mesh, this);
+    }
+
+    if (!resolved_mesh)
+    {
+      qDebug() << "could no create vao";
       continue;
     }
 
-    const PSX_Material& material = *object.materials[primitive.materialIndex];
-    QOpenGLShaderProgram* shader_program = m_shaders.getProgram(object, material);
+    if (item.features != resolved_features)
+    {
+      resolved_features = item.features;
+      resolved_program = m_shaders.getProgram(PSX_UberShader::config(item.features));
+    }
+
+    if (!resolved_program)
+    {
+      continue;
+    }
+
+    if (item.material != resolved_material)
+    {
+      resolved_material = item.material;
+      resolved_texture = nullptr;
+      resolved_texture_windows = nullptr;
+
+      if (material.map)
+      {
+        resolved_texture = m_textures.getTextureFor(*material.map);
+      }
+      else if (material.vram)
+      {
+        resolved_texture = m_textures.getTextureFor(*material.vram);
+        resolved_texture_windows = resolved_texture ? m_textures.getTextureWindowsFor(*material.vram) : nullptr;
+      }
+    }
 
-    if (!shader_program)
+    if (material.vram && !resolved_texture)
     {
+      // still being uploaded
       continue;
     }
 
-    if (shader_program != active_program)
+    if (resolved_mesh != active_mesh)
     {
-      active_program = shader_program;
+      active_mesh = resolved_mesh;
+      active_mesh->vao.bind();
+      ++stats.meshChanges;
+    }
+
+    if (resolved_program != active_program)
+    {
+      active_program = resolved_program;
       active_program->bind();
+      active_uniforms = &m_shaders.uniforms(active_program);
+      ++stats.programChanges;
+
+      active_features = -1;
+    }
+
+    // the object block is not part of the program state
+    if (item.transform != active_transform)
+    {
+      active_transform = item.transform;
+      gl->glBindBufferRange(GL_UNIFORM_BUFFER,
+                            OBJECT_BLOCK_BINDING,
+                            m_uniform_stream->bufferId(),
+                            m_object_blocks_offset + GLintptr(item.transform) * m_object_block_stride,
+                            sizeof(ObjectBlock));
+    }
+
+    if (dynamic_branching && item.features != active_features)
+    {
+      active_features = item.features;
+      active_program->setUniformValue(active_uniforms->features, active_features);
     }
 
-    shader_program->setUniformValue("model_matrix", modelTransform);
-    shader_program->setUniformValue("view_matrix", viewMatrix);
-    shader_program->setUniformValue("projection_matrix", projectionMatrix);
+    active_program->setUniformValue(active_uniforms->materialColor, QColor(material.color));
 
-    shader_program->setUniformValue("material_color", QColor(material.color));
+    if (material.vram)
+    {
+      if (resolved_texture != active_vram)
+      {
+        active_vram = resolved_texture;
+        active_vram->bind(VRAM_TEXTURE_UNIT);
+        ++stats.textureChanges;
+      }
+    }
+    else if (resolved_texture && resolved_texture != active_texture)
+    {
+      active_texture = resolved_texture;
+      active_texture->bind(TEXTURE_DIFFUSE_UNIT);
+      ++stats.textureChanges;
+    }
 
-    if (material.map)
+    if (resolved_texture_windows && resolved_texture_windows != active_texture_windows)
     {
-      QOpenGLTexture* texture = m_textures.getTextureFor(*material.map);
-      texture->bind();
-      shader_program->setUniformValue("texture_diffuse", 0);
+      active_texture_windows = resolved_texture_windows;
+      active_texture_windows->bind(TEXTURE_WINDOWS_UNIT);
+      ++stats.textureChanges;
     }
 
-    if (material.lighting)
+    if (item.bakedAnimations != resolved_baked_animations_source)
     {
-      shader_program->setUniformValue("light.direction", QVector3D(-1, 1, -1));
-      shader_program->setUniformValue("light.ambient", QVector3D(0.7, 0.7, 0.7));
-      shader_program->setUniformValue("light.diffuse", QVector3D(0.3, 0.3, 0.3));
+      resolved_baked_animations_source = item.bakedAnimations;
+      resolved_baked_animations = item.bakedAnimations ? m_textures.getTextureFor(*item.bakedAnimations) : nullptr;
+    }
+
+    if (resolved_baked_animations && resolved_baked_animations != active_baked_animations)
+    {
+      active_baked_animations = resolved_baked_animations;
+      active_baked_animations->bind(BAKED_ANIMATIONS_UNIT);
+      ++stats.textureChanges;
+    }
+
+    // translucent items are sorted after all the opaque ones
+    if (renderkey::isTranslucent(item.key) && material.blendMode != active_blend_mode)
+    {
+      if (active_blend_mode == -1)
+      {
+        glEnable(GL_BLEND);
+        glDepthMask(GL_FALSE);
+      }
+
+      active_blend_mode = material.blendMode;
+      setBlendMode(active_blend_mode);
+      ++stats.blendChanges;
     }
 
     GLenum mode = GL_TRIANGLES;
-    if (primitive.type == PSX_Object3D::Line)
+    if (item.primitive.type == PSX_Object3D::Line)
     {
       mode = GL_LINES;
     }
 
-    glDrawArrays(mode, primitive.index, primitive.count);
+    const size_t index_size = active_mesh->indexType == GL_UNSIGNED_INT ? sizeof(uint32_t) : sizeof(uint16_t);
+    const auto* offset = reinterpret_cast<const GLvoid*>(item.primitive.index * index_size);
+    glDrawElements(mode, item.primitive.count, active_mesh->indexType, offset);
+    ++stats.drawCalls;
+  }
+
+  if (active_blend_mode != -1)
+  {
+    glBlendEquation(GL_FUNC_ADD);
+    glDepthMask(GL_TRUE);
+    glDisable(GL_BLEND);
   }
 
   if (active_program)
@@ -199,5 +1074,35 @@ void SceneRenderer::render(PSX_Object3D& object, const QMatrix4x4& modelTransfor
     active_program->release();
   }
 
-  m_vao.release();
+  if (active_mesh)
+  {
+    active_mesh->vao.release();
+  }
+}
+
+void SceneRenderer::setBlendMode(int mode)
+{
+  // PSX semi-transparency modes, B is the background and F the foreground
+  switch (mode)
+  {
+  case 1: // B + F
+    glBlendEquation(GL_FUNC_ADD);
+    glBlendFunc(GL_ONE, GL_ONE);
+    break;
+  case 2: // B - F
+    glBlendEquation(GL_FUNC_REVERSE_SUBTRACT);
+    glBlendFunc(GL_ONE, GL_ONE);
+    break;
+  case 3: // B + 0.25 x F
+    glBlendEquation(GL_FUNC_ADD);
+    glBlendColor(0.25f, 0.25f, 0.25f, 0.25f);
+    glBlendFunc(GL_CONSTANT_COLOR, GL_ONE);
+    break;
+  case 0: // 0.5 x B + 0.5 x F
+  default:
+    glBlendEquation(GL_FUNC_ADD);
+    glBlendColor(0.5f, 0.5f, 0.5f, 0.5f);
+    glBlendFunc(GL_CONSTANT_COLOR, GL_CONSTANT_COLOR);
+    break;
+  }
 }
@@ -4,9 +4,19 @@
 
 #pragma once
 
+#include "flatscene.h"
+#include "framepacket.h"
+#include "gpuresourcemanager.h"
 #include "openglbuffer.h"
 #include "psxobject3d.h"
+#include "renderqueue.h"
+#include "shaderinterface.h"
+#include "shadermodebenchmark.h"
+#include "textureuploader.h"
 #include "ubershader.h"
+#include "vertexanimation.h"
+
+#include "jobsystem.h"
 
 #include <QOpenGLBuffer>
 #include <QOpenGLContext>
@@ -14,6 +24,18 @@
 #include <QOpenGLTexture>
 #include <QOpenGLVertexArrayObject>
 
+#include <array>
+#include <unordered_map>
+
+/**
+ * @brief the programs drawing PSX models
+ *
+ * By default, a program is compiled for each combination of features,
+ * selected with preprocessor defines. With dynamic branching, a single
+ * program is used for everything and the features of each draw are
+ * passed in the 'features' uniform, which trades branches in the
+ * fragment shader for fewer program changes.
+ */
 class PSX_UberShader : public UberShader
 {
 public:
@@ -28,13 +50,71 @@ public:
     bool has_normals = false;
     bool vertexColors = false;
     bool hasTexture = false;
+    bool vram = false;
     bool lighting = false;
   };
 
+  /**
+   * @brief the bits of the 'features' uniform, must match psxmodel.frag
+   */
+  enum Feature
+  {
+    FeatureColors = 1,
+    FeatureUV = 2,
+    FeatureNormals = 4,
+    FeatureTexture = 8,
+    FeatureVram = 16,
+    FeatureLighting = 32,
+  };
+
+  static Config config(const PSX_Mesh& data, const PSX_Material& material)
+  {
+    Config conf;
+    conf.has_colors = data.hasColors;
+    conf.has_uv = data.hasUV;
+    conf.has_normals = data.hasNormals;
+    conf.vertexColors = material.vertexColors;
+    conf.hasTexture = material.map != nullptr;
+    conf.vram = material.vram != nullptr;
+    conf.lighting = material.lighting;
+    return conf;
+  }
+
+  /**
+   * @brief returns the configuration encoded by a set of Feature flags
+   */
+  static Config config(int features)
+  {
+    Config conf;
+    conf.has_colors = features & FeatureColors;
+    conf.has_uv = features & FeatureUV;
+    conf.has_normals = features & FeatureNormals;
+    conf.hasTexture = features & FeatureTexture;
+    conf.vram = features & FeatureVram;
+    conf.lighting = features & FeatureLighting;
+    return conf;
+  }
+
+  static int features(const Config& conf)
+  {
+    return (conf.has_colors ? FeatureColors : 0) | (conf.has_uv ? FeatureUV : 0)
+           | (conf.has_normals ? FeatureNormals : 0) | (conf.hasTexture ? FeatureTexture : 0)
+           | (conf.vram ? FeatureVram : 0) | (conf.lighting ? FeatureLighting : 0);
+  }
+
+  bool dynamicBranching() const { return m_dynamic_branching; }
+  void setDynamicBranching(bool on) { m_dynamic_branching = on; }
+
   QOpenGLShaderProgram* getProgram(Config conf)
   {
     glsl::PreprocessorDefines defines;
 
+    if (m_dynamic_branching)
+    {
+      defines.emplace_back("DYNAMIC_BRANCHING");
+      return instantiate(defines);
+    }
+
     if (conf.has_colors)
     {
       defines.emplace_back("MESH_HAS_COLORS");
@@ -55,52 +135,256 @@ public:
       defines.emplace_back("MATERIAL_TEXTURE");
     }
 
+    if (conf.vram)
+    {
+      defines.emplace_back("MATERIAL_VRAM");
+    }
+
     if (conf.lighting)
     {
       defines.emplace_back("LIGHTING_ON");
     }
 
-    auto sp = UberShader::getProgram(defines, {});
-    return sp.get();
+    return instantiate(defines);
   }
 
-  QOpenGLShaderProgram* getProgram(const PSX_Object3D& data, const PSX_Material& material)
+  /**
+   * @brief the locations of the uniforms that are set for each draw
+   *
+   * Everything else is either set once when the program is linked or
+   * read from a uniform block.
+   */
+  struct Uniforms
   {
-    Config conf;
-    conf.has_colors = !data.colors.empty();
-    conf.has_uv = !data.uv.empty();
-    conf.has_normals = !data.normals.empty();
-    conf.vertexColors = material.vertexColors;
-    conf.hasTexture = material.map != nullptr;
-    conf.lighting = material.lighting;
-    return getProgram(conf);
+    int materialColor = -1;
+    int features = -1;
+  };
+
+  const Uniforms& uniforms(const QOpenGLShaderProgram* program) const { return m_uniforms.at(program); }
+
+  /**
+   * @brief compiles the programs of every configuration a PSX model can be drawn with
+   *
+   * Programs are otherwise compiled the first time a configuration is
+   * drawn, which stalls that frame. Linked programs are stored in Qt's
+   * shader disk cache, so this is mostly loading binaries after the
+   * first run.
+   *
+   * Only the programs of the current mode are compiled.
+   */
+  void compileAllPrograms()
+  {
+    if (m_dynamic_branching)
+    {
+      getProgram(Config());
+      return;
+    }
+
+    for (int mesh(0); mesh < 8; ++mesh)
+    {
+      Config conf;
+      conf.has_colors = mesh & 1;
+      conf.has_uv = mesh & 2;
+      conf.has_normals = mesh & 4;
+
+      // 0: untextured, 1: texture, 2: vram
+      for (int material(0); material < 3; ++material)
+      {
+        // only meshes with uv have textured materials
+        if (material != 0 && !conf.has_uv)
+        {
+          continue;
+        }
+
+        conf.hasTexture = material == 1;
+        conf.vram = material == 2;
+
+        for (bool lighting : {false, true})
+        {
+          conf.lighting = lighting;
+          getProgram(conf);
+        }
+      }
+    }
+  }
+
+  QOpenGLShaderProgram* getProgram(const PSX_Mesh& data, const PSX_Material& material)
+  {
+    return getProgram(config(data, material));
+  }
+
+private:
+  QOpenGLShaderProgram* instantiate(const glsl::PreprocessorDefines& defines)
+  {
+    UberShaderGetInstanceResult result = UberShader::getInstance(defines, {});
+
+    if (result.shader_program && !result.cached)
+    {
+      m_uniforms[result.shader_program.get()] = setupProgram(*result.shader_program);
+    }
+
+    return result.shader_program.get();
   }
+
+  /**
+   * @brief binds the uniform blocks and samplers of a newly linked program
+   */
+  static Uniforms setupProgram(QOpenGLShaderProgram& program);
+
+private:
+  bool m_dynamic_branching = false;
+  std::unordered_map<const QOpenGLShaderProgram*, Uniforms> m_uniforms;
 };
 
+/**
+ * @brief creates and updates the textures of PSX_Texture and PSX_Vram objects
+ *
+ * Textures are owned by a GpuResourceManager, which may evict them.
+ *
+ * If an uploader is set, new textures are allocated by the render context
+ * and filled from the uploader's thread. Until the upload completes,
+ * a 1x1 white texture is returned for images and no texture is returned
+ * for VRAMs.
+ * Updates of a region of an existing texture are done synchronously.
+ */
 class OpenGLTextureManager
 {
 public:
+  explicit OpenGLTextureManager(GpuResourceManager& resources);
+  ~OpenGLTextureManager();
+
+  /**
+   * @brief uploads new textures with a background uploader
+   *
+   * The uploader must outlive the manager, whose destructor stops it and
+   * deletes the fences of its last uploads.
+   */
+  void setUploader(TextureUploader* uploader);
+
   QOpenGLTexture* getTextureFor(PSX_Texture& psxTexture);
+  QOpenGLTexture* getTextureFor(PSX_Vram& psxVram);
+
+  /**
+   * @brief returns a texture holding the texture windows of a VRAM, one RGBA16UI texel each
+   */
+  QOpenGLTexture* getTextureWindowsFor(PSX_Vram& psxVram);
 
-  void deleteUnreachableTextures();
+  /**
+   * @brief returns an RGBA32F texture holding baked animations, uploaded synchronously
+   *
+   * Returns nullptr if the animations do not fit in a texture of the
+   * context, see BakedAnimations::fitsInTexture().
+   */
+  QOpenGLTexture* getTextureFor(BakedAnimations& animations);
+
+  /**
+   * @brief makes the textures whose upload has completed available
+   *
+   * This should be called once per frame, before requesting textures.
+   */
+  void processCompletedUploads();
 
 private:
-  using Key = PSX_Texture*;
-  struct Value
+  struct Value : GpuResource
   {
     int revision;
     std::unique_ptr<QOpenGLTexture> texture;
+    size_t textureBytes = 0;
+    bool uploading = false; ///< the content of 'texture' is being uploaded
+    std::unique_ptr<QOpenGLTexture> textureWindows; ///< for a PSX_Vram
+    size_t textureWindowCount = 0;
+
+    size_t sizeInBytes() const override;
+    bool busy() const override { return uploading; }
   };
-  std::map<Key, Value> m_textures;
 
-  struct PSX_Texture_Entry
+  struct BakedAnimationsValue : GpuResource
   {
-    Key key;
-    std::weak_ptr<PSX_Texture> weakptr;
+    int frameCount = 0;
+    std::unique_ptr<QOpenGLTexture> texture;
+    size_t bytes = 0;
+
+    size_t sizeInBytes() const override { return bytes; }
   };
-  std::vector<PSX_Texture_Entry> m_entries;
+
+  template<typename T>
+  Value* getValue(T& source);
+
+  template<typename T>
+  void createTexture(Value& value, const T& source);
+
+  QOpenGLTexture* placeholderFor(const PSX_Texture& psxTexture);
+  QOpenGLTexture* placeholderFor(const PSX_Vram& psxVram);
+
+private:
+  GpuResourceManager& m_resources;
+  TextureUploader* m_uploader = nullptr;
+  std::vector<CompletedTextureUpload> m_completed_uploads; ///< not yet signaled
+  std::unordered_map<GLuint, Value*> m_uploads; ///< values whose texture is being uploaded, by texture id
+  std::unique_ptr<QOpenGLTexture> m_placeholder;
 };
 
+/**
+ * @brief the GPU buffers of a PSX_Mesh
+ */
+struct OpenGLMesh : GpuResource
+{
+  QOpenGLVertexArrayObject vao;
+  struct
+  {
+    std::unique_ptr<QOpenGLBuffer> vertex; ///< interleaved PSX_Vertex
+    std::unique_ptr<QOpenGLBuffer> index;
+  } buffers;
+  GLenum indexType = GL_UNSIGNED_SHORT; ///< GL_UNSIGNED_INT for meshes with 'wideIndices'
+  size_t bytes = 0; ///< size of the buffers
+
+  size_t sizeInBytes() const override { return bytes; }
+};
+
+/**
+ * @brief creates the GPU buffers of PSX_Mesh objects
+ *
+ * Meshes are owned by a GpuResourceManager, which may evict them.
+ */
+class OpenGLMeshManager
+{
+public:
+  explicit OpenGLMeshManager(GpuResourceManager& resources);
+
+  OpenGLMesh* getMeshFor(PSX_Mesh& psxMesh, QOpenGLFunctions* gl);
+
+private:
+  GpuResourceManager& m_resources;
+};
+
+/**
+ * @brief counts the GL state changes of a frame
+ */
+struct RenderStats
+{
+  int drawCalls = 0;
+  int programChanges = 0;
+  int textureChanges = 0;
+  int meshChanges = 0;
+  int blendChanges = 0;
+  int culledNodes = 0;
+  int evictedResources = 0;
+
+  int stateChanges() const { return programChanges + textureChanges + meshChanges + blendChanges; }
+};
+
+/**
+ * @brief draws a scene of PSX_Object3D
+ *
+ * A frame is prepared from a snapshot of the scene (see FlatScene) into
+ * a FramePacket, without any GL call, and the packet is then drawn.
+ *
+ * If the MMDVIEWER_PIPELINED_RENDERING environment variable is set to 1,
+ * the packet of a frame is prepared by the JobSystem while the GL thread
+ * draws the packet of the previous frame, which overlaps the preparation
+ * with the driver's work. The frame that is drawn is then one frame
+ * behind the scene, see framePending().
+ */
 class SceneRenderer : public QOpenGLFunctions
 {
 private:
@@ -112,45 +396,77 @@ public:
   QMatrix4x4 viewMatrix;
 
 private:
+  GpuResourceManager m_resources;
+  // destroyed after the texture manager, which stops it and collects its last uploads,
+  // and before the resources, so that no upload is in flight when the textures are deleted
+  std::unique_ptr<TextureUploader> m_uploader;
   OpenGLTextureManager m_textures;
-
-  QOpenGLVertexArrayObject m_vao;
-  struct
-  {
-    std::unique_ptr<QOpenGLBuffer> vertex;
-    std::unique_ptr<QOpenGLBuffer> index;
-    std::unique_ptr<QOpenGLBuffer> color;
-    std::unique_ptr<QOpenGLBuffer> uv;
-    std::unique_ptr<QOpenGLBuffer> normal;
-  } m_buffers;
+  OpenGLMeshManager m_meshes;
+  // double buffered, a packet is prepared from its scene while the other one is drawn
+  std::array<FlatScene, 2> m_scenes;
+  std::array<FramePacket, 2> m_packets;
+  bool m_pipelined = false;
+  JobPtr m_prepare_job;  ///< preparing the packet of the last frame, when pipelined
+  int m_prepared = -1;   ///< index of the packet of the last frame
+  bool m_frame_pending = false;
+  RenderStats m_stats;
+  std::unique_ptr<ShaderModeBenchmark> m_benchmark;
+  std::unique_ptr<StreamingBuffer> m_uniform_stream; ///< frame and object blocks
+  GLint m_uniform_alignment = 1; ///< GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+  GLint m_object_block_stride = 0; ///< sizeof(ObjectBlock) rounded up to the alignment
+  GLint m_max_texture_size = 1024; ///< GL_MAX_TEXTURE_SIZE
+  GLintptr m_object_blocks_offset = 0;
 
 public:
-  explicit SceneRenderer(QOpenGLContext* ctx)
-      : QOpenGLFunctions(ctx)
-      , m_context(ctx)
-  {}
+  /**
+   * @brief creates a renderer for the current context
+   *
+   * Dynamic branching is enabled if the MMDVIEWER_DYNAMIC_BRANCHING
+   * environment variable is set to 1. If MMDVIEWER_SHADER_BENCHMARK is
+   * set, the renderer alternates between the two shader modes and prints
+   * their frame times, see ShaderModeBenchmark.
+   */
+  explicit SceneRenderer(QOpenGLContext* ctx);
+  ~SceneRenderer();
 
-  void render(Object3D& model)
-  {
-    glEnable(GL_CULL_FACE);
+  void render(Object3D& model);
 
-    QMatrix4x4 model_matrix;
-    {
-      // TMD y-down/z-depth, so we need to apply a transform to be z-up.
-      model_matrix(1, 1) = 0;
-      model_matrix(2, 2) = 0;
-      model_matrix(0, 0) = 1;
-      model_matrix(1, 2) = 1;
-      model_matrix(2, 1) = -1;
-    }
+  /**
+   * @brief returns whether the scene changed since the frame that was last drawn
+   *
+   * This only happens with pipelined rendering, another frame should then
+   * be rendered to show the latest state of the scene.
+   */
+  bool framePending() const { return m_frame_pending; }
 
-    recursiveRender(model, model_matrix);
+  bool dynamicBranching() const;
+  void setDynamicBranching(bool on);
 
-    m_textures.deleteUnreachableTextures();
-  }
+  const RenderStats& stats() const { return m_stats; }
+
+  /**
+   * @brief returns the GL_MAX_TEXTURE_SIZE of the context
+   */
+  int maxTextureSize() const { return m_max_texture_size; }
+
+  GpuResourceManager& resources() { return m_resources; }
 
 private:
-  bool setupVAOAndVBO();
-  void recursiveRender(Object3D& object, QMatrix4x4 modelTransform);
-  void render(PSX_Object3D& object, const QMatrix4x4& modelTransform);
+  /**
+   * @brief culls and sorts a scene and packs its uniform blocks
+   * @note this function does not use the GL context and can run in any thread
+   */
+  static void prepare(FramePacket& packet, const FlatScene& scene, const FrameParameters& parameters);
+  static void collect(FramePacket& packet, const FlatScene& scene);
+  static void enqueue(FramePacket& packet,
+                      const FlatScene::Node& node,
+                      const QMatrix4x4& modelTransform,
+                      const AABB& worldBounds,
+                      const TransformAnimation& animation = {},
+                      BakedAnimations* bakedAnimations = nullptr);
+  static void packUniformBlocks(FramePacket& packet);
+
+  bool writeUniformBlocks(const FramePacket& packet);
+  void draw(const FramePacket& packet);
+  void setBlendMode(int mode);
 };
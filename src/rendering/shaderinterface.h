@@ -0,0 +1,111 @@
+// Copyright (C) 2025 Vincent Chambrin
+// This file is part of the 'mmd-viewer' project
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+/**
+ * @file shaderinterface.h
+ * @brief the uniform blocks and texture units shared by the renderer and psxmodel.vert/.frag
+ */
+
+#include <QMatrix3x3>
+#include <QMatrix4x4>
+#include <QVector3D>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+
+namespace shaderinterface
+{
+
+enum TextureUnit
+{
+  TEXTURE_DIFFUSE_UNIT = 0,
+  TEXTURE_WINDOWS_UNIT = 1,
+  // the PSX_Vram is a usampler2D and cannot share a unit with the
+  // sampler2D of texture materials when both are declared.
+  VRAM_TEXTURE_UNIT = 2,
+  BAKED_ANIMATIONS_UNIT = 3,
+};
+
+enum UniformBlockBinding
+{
+  FRAME_BLOCK_BINDING = 0,
+  OBJECT_BLOCK_BINDING = 1,
+};
+
+/**
+ * @brief the std140 layout of the 'FrameBlock' uniform block, updated once per frame
+ */
+struct FrameBlock
+{
+  float viewMatrix[16];
+  float projectionMatrix[16];
+  float lightDirection[3];
+  float padding0;
+  float lightAmbient[3];
+  float padding1;
+  float lightDiffuse[3];
+  float time; ///< in seconds, for baked animations
+};
+
+static_assert(sizeof(FrameBlock) == 176);
+
+/**
+ * @brief the std140 layout of the 'ObjectBlock' uniform block, one per transform
+ *
+ * A mat3 is stored as three vec4 columns.
+ * When 'animation[0]' is not -1, the transform of the baked node is
+ * applied before the model matrix, see TransformAnimation.
+ */
+struct ObjectBlock
+{
+  float modelMatrix[16];
+  float normalMatrix[3][4];
+  int32_t animation[4];    ///< node, first frame, frame count, loop start
+  float animationTime[4]; ///< frame, time offset, unused, unused
+};
+
+static_assert(sizeof(ObjectBlock) == 144);
+
+inline void write(float (&dest)[16], const QMatrix4x4& m)
+{
+  // both are column-major
+  std::memcpy(dest, m.constData(), sizeof(dest));
+}
+
+inline void write(float (&dest)[3], const QVector3D& v)
+{
+  dest[0] = v.x();
+  dest[1] = v.y();
+  dest[2] = v.z();
+}
+
+inline void write(float (&dest)[3][4], const QMatrix3x3& m)
+{
+  const float* src = m.constData();
+
+  for (int column(0); column < 3; ++column)
+  {
+    std::memcpy(dest[column], src + 3 * column, 3 * sizeof(float));
+    dest[column][3] = 0;
+  }
+}
+
+inline ObjectBlock objectBlock(const QMatrix4x4& modelMatrix)
+{
+  ObjectBlock block;
+  write(block.modelMatrix, modelMatrix);
+  write(block.normalMatrix, modelMatrix.normalMatrix());
+  block.animation[0] = -1;
+  block.animation[1] = 0;
+  block.animation[2] = 0;
+  block.animation[3] = -1;
+  std::fill(std::begin(block.animationTime), std::end(block.animationTime), 0.f);
+  return block;
+}
+
+} // namespace shaderinterface
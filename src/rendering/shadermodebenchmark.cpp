@@ -0,0 +1,108 @@
+// Copyright (C) 2025 Vincent Chambrin
+// This file is part of the 'mmd-viewer' project
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "shadermodebenchmark.h"
+
+#include "scenerenderer.h"
+
+#include <QDebug>
+
+ShaderModeBenchmark::ShaderModeBenchmark()
+{
+  for (Query& q : m_queries)
+  {
+    q.query = std::make_unique<QOpenGLTimerQuery>();
+
+    if (!q.query->create())
+    {
+      q.query.reset();
+    }
+  }
+}
+
+ShaderModeBenchmark::~ShaderModeBenchmark() = default;
+
+void ShaderModeBenchmark::beginFrame(bool dynamicBranching)
+{
+  m_dynamic_branching = dynamicBranching;
+  m_timer.start();
+
+  readQueries(false);
+
+  Query& q = m_queries[m_current_query];
+
+  if (q.query && !q.pending)
+  {
+    q.query->begin();
+  }
+}
+
+bool ShaderModeBenchmark::endFrame(const RenderStats& stats)
+{
+  Query& q = m_queries[m_current_query];
+
+  if (q.query && !q.pending)
+  {
+    q.query->end();
+    q.pending = true;
+    q.dynamicBranching = m_dynamic_branching;
+  }
+
+  m_current_query = (m_current_query + 1) % m_queries.size();
+
+  Measures& m = m_measures[m_dynamic_branching];
+  m.frames += 1;
+  m.cpuTime += m_timer.nsecsElapsed();
+  m.programChanges += stats.programChanges;
+  m.drawCalls += stats.drawCalls;
+
+  if (++m_run_frames < FRAMES_PER_RUN)
+  {
+    return false;
+  }
+
+  m_run_frames = 0;
+
+  // both modes were measured, the queries of the last run are waited for
+  if (m_dynamic_branching)
+  {
+    readQueries(true);
+    report();
+    m_measures = {};
+  }
+
+  return true;
+}
+
+void ShaderModeBenchmark::readQueries(bool wait)
+{
+  for (Query& q : m_queries)
+  {
+    if (q.pending && (wait || q.query->isResultAvailable()))
+    {
+      Measures& m = m_measures[q.dynamicBranching];
+      m.gpuTime += q.query->waitForResult();
+      m.gpuFrames += 1;
+      q.pending = false;
+    }
+  }
+}
+
+void ShaderModeBenchmark::report()
+{
+  auto print = [](const char* name, const Measures& m) {
+    if (m.frames == 0)
+    {
+      return;
+    }
+
+    qDebug().nospace() << name << ": " << m.frames << " frames, cpu " << (m.cpuTime / m.frames) / 1000.0 << " us, gpu "
+                       << (m.gpuFrames ? double(m.gpuTime / m.gpuFrames) / 1000.0 : 0.0) << " us, "
+                       << double(m.programChanges) / m.frames << " program changes, "
+                       << double(m.drawCalls) / m.frames << " draw calls";
+  };
+
+  print("permutations", m_measures[false]);
+  print("dynamic branching", m_measures[true]);
+}
@@ -0,0 +1,72 @@
+// Copyright (C) 2025 Vincent Chambrin
+// This file is part of the 'mmd-viewer' project
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include <QElapsedTimer>
+#include <QOpenGLTimerQuery>
+
+#include <array>
+#include <cstdint>
+#include <memory>
+
+struct RenderStats;
+
+/**
+ * @brief compares the frame times of the permutation and dynamic branching shader modes
+ *
+ * The renderer switches mode every FRAMES_PER_RUN frames. Once both modes
+ * have been measured, the average CPU time spent collecting and drawing,
+ * the average GPU time and the number of program changes per frame are
+ * printed for each of them.
+ *
+ * GPU times are read from timer queries a few frames later, so that
+ * the measure does not stall the pipeline.
+ */
+class ShaderModeBenchmark
+{
+public:
+  static constexpr int FRAMES_PER_RUN = 200;
+
+  ShaderModeBenchmark();
+  ~ShaderModeBenchmark();
+
+  void beginFrame(bool dynamicBranching);
+
+  /**
+   * @brief records the measures of the frame
+   *
+   * Returns true if the renderer should switch to the other mode.
+   */
+  bool endFrame(const RenderStats& stats);
+
+private:
+  struct Measures
+  {
+    int frames = 0;
+    int gpuFrames = 0;
+    int64_t cpuTime = 0;
+    uint64_t gpuTime = 0;
+    int64_t programChanges = 0;
+    int64_t drawCalls = 0;
+  };
+
+  struct Query
+  {
+    std::unique_ptr<QOpenGLTimerQuery> query;
+    bool pending = false;
+    bool dynamicBranching = false;
+  };
+
+  void readQueries(bool wait);
+  void report();
+
+private:
+  QElapsedTimer m_timer;
+  std::array<Query, 4> m_queries;
+  size_t m_current_query = 0;
+  bool m_dynamic_branching = false;
+  int m_run_frames = 0;
+  std::array<Measures, 2> m_measures; ///< indexed by dynamicBranching
+};
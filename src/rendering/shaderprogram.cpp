@@ -56,14 +56,14 @@ std::unique_ptr<QOpenGLShaderProgram> compile_shader(const ShaderProgramConfig&
 {
   auto sp = std::make_unique<QOpenGLShaderProgram>();
 
-  sp->addShaderFromSourceCode(QOpenGLShader::Vertex,
-                              load_shader(conf.vert, conf.defines, conf.variables));
-  sp->addShaderFromSourceCode(QOpenGLShader::Fragment,
-                              load_shader(conf.frag, conf.defines, conf.variables));
+  sp->addCacheableShaderFromSourceCode(QOpenGLShader::Vertex,
+                                       load_shader(conf.vert, conf.defines, conf.variables));
+  sp->addCacheableShaderFromSourceCode(QOpenGLShader::Fragment,
+                                       load_shader(conf.frag, conf.defines, conf.variables));
 
   if (!conf.geom.isEmpty())
-    sp->addShaderFromSourceCode(QOpenGLShader::Geometry,
-                                load_shader(conf.geom, conf.defines, conf.variables));
+    sp->addCacheableShaderFromSourceCode(QOpenGLShader::Geometry,
+                                         load_shader(conf.geom, conf.defines, conf.variables));
 
   sp->link();
 
@@ -1,5 +1,53 @@
 #version 330 core
 
+// features, see PSX_UberShader::Feature
+const int FEATURE_COLORS = 1;
+const int FEATURE_UV = 2;
+const int FEATURE_NORMALS = 4;
+const int FEATURE_TEXTURE = 8;
+const int FEATURE_VRAM = 16;
+const int FEATURE_LIGHTING = 32;
+
+#if defined(DYNAMIC_BRANCHING)
+// every feature is compiled in, those of the current draw are selected
+// with a uniform instead of using a different program.
+#define MESH_HAS_COLORS
+#define MESH_HAS_UV
+#define MESH_HAS_NORMALS
+#define MATERIAL_TEXTURE
+#define MATERIAL_VRAM
+#define LIGHTING_ON
+
+uniform int features;
+#else
+// known at compile time, the branches below are optimized out
+const int features = 0
+#if defined(MESH_HAS_COLORS)
+    | FEATURE_COLORS
+#endif
+#if defined(MESH_HAS_UV)
+    | FEATURE_UV
+#endif
+#if defined(MESH_HAS_NORMALS)
+    | FEATURE_NORMALS
+#endif
+#if defined(MATERIAL_TEXTURE)
+    | FEATURE_TEXTURE
+#endif
+#if defined(MATERIAL_VRAM)
+    | FEATURE_VRAM
+#endif
+#if defined(LIGHTING_ON)
+    | FEATURE_LIGHTING
+#endif
+    ;
+#endif
+
+bool has_feature(int feature)
+{
+    return (features & feature) != 0;
+}
+
 #if defined(MESH_HAS_COLORS)
 in vec3 v_color;
 #endif
@@ -18,41 +66,115 @@ uniform vec4 material_color;
 uniform sampler2D texture_diffuse;
 #endif
 
-#if defined(LIGHTING_ON)
-struct Light {
-    vec3 direction;
+#if defined(MATERIAL_VRAM)
+uniform usampler2D vram; // not on the unit of texture_diffuse, both are declared with DYNAMIC_BRANCHING
+uniform usampler2D texture_windows; // one texel per PSX_TextureWindow: page, bpp, clut x, clut y
+flat in int v_texture_window;
 
-    vec3 ambient;
-    vec3 diffuse;
-};
-uniform Light light;
+// converts a A1B5G5R5 color, see colorFromPsx16bit()
+vec4 psx_color(uint c)
+{
+    vec3 rgb = vec3(uvec3(c, c >> 5u, c >> 10u) & 31u) / 31.0;
+    float alpha = (c & 0x8000u) != 0u ? 0.0 : 1.0;
+
+    // black is transparent, unless the stp bit is set
+    if ((c & 0x7FFFu) == 0u)
+    {
+        alpha = 1.0 - alpha;
+    }
+
+    return vec4(rgb, alpha);
+}
+
+vec4 sample_vram(vec2 uv)
+{
+    uvec4 window = texelFetch(texture_windows, ivec2(v_texture_window, 0), 0);
+
+    // texture pages are 64x256 VRAM units, 16 pages per row
+    ivec2 texture_page = ivec2(int(window.x % 16u) * 64, int(window.x / 16u) * 256);
+    int texture_bpp = int(window.y);
+    ivec2 clut = ivec2(window.zw);
+
+    ivec2 texel = clamp(ivec2(floor(uv)), ivec2(0), ivec2(255));
+
+    if (texture_bpp == 4)
+    {
+        uint word = texelFetch(vram, texture_page + ivec2(texel.x >> 2, texel.y), 0).r;
+        uint index = (word >> uint((texel.x & 3) * 4)) & 0xFu;
+        return psx_color(texelFetch(vram, clut + ivec2(int(index), 0), 0).r);
+    }
+    else if (texture_bpp == 8)
+    {
+        uint word = texelFetch(vram, texture_page + ivec2(texel.x >> 1, texel.y), 0).r;
+        uint index = (word >> uint((texel.x & 1) * 8)) & 0xFFu;
+        return psx_color(texelFetch(vram, clut + ivec2(int(index), 0), 0).r);
+    }
+    else
+    {
+        return psx_color(texelFetch(vram, texture_page + texel, 0).r);
+    }
+}
 #endif
 
+// std140 block, see shaderinterface.h
+layout(std140) uniform FrameBlock
+{
+    mat4 view_matrix;
+    mat4 projection_matrix;
+    vec3 light_direction;
+    vec3 light_ambient;
+    vec3 light_diffuse;
+    float time; // in seconds
+};
+
 out vec4 FragColor;
 
 void main()
 {
+    vec3 result_color = material_color.rgb;
     float opacity = 1;
+
+#if defined(MESH_HAS_COLORS)
+    if (has_feature(FEATURE_COLORS))
+    {
+        result_color = v_color / 255;
+    }
+#endif
+
 #if defined(MATERIAL_TEXTURE)
-    vec4 texColor = texture(texture_diffuse, v_uv.xy);
-    vec3 result_color = texColor.rgb;
-    opacity = texColor.a;
-#elif defined(MESH_HAS_COLORS)
-    vec3 result_color = v_color / 255;
-#else
-    vec3 result_color = material_color.rgb;
+    if (has_feature(FEATURE_TEXTURE))
+    {
+        // v_uv is in texels, the first row of the texture is at v = 0
+        vec2 tex_size = vec2(textureSize(texture_diffuse, 0));
+        vec2 uv = v_uv / tex_size + 0.0001;
+        vec4 texColor = texture(texture_diffuse, uv);
+        result_color = texColor.rgb;
+        opacity = texColor.a;
+    }
+#endif
+
+#if defined(MATERIAL_VRAM)
+    if (has_feature(FEATURE_VRAM))
+    {
+        vec4 texColor = sample_vram(v_uv);
+        result_color = texColor.rgb;
+        opacity = texColor.a;
+    }
 #endif
 
 #if defined(LIGHTING_ON) && defined(MESH_HAS_NORMALS)
-    vec3 ambient = light.ambient * result_color;
+    if (has_feature(FEATURE_LIGHTING) && has_feature(FEATURE_NORMALS))
+    {
+        vec3 ambient = light_ambient * result_color;
 
-    // diffuse
-    vec3 norm = normalize(v_normal);
-    vec3 lightDir = normalize(-light.direction);
-    float diff = max(dot(norm, lightDir), 0.0);
-    vec3 diffuse = diff * result_color;
+        // diffuse
+        vec3 norm = normalize(v_normal);
+        vec3 lightDir = normalize(-light_direction);
+        float diff = max(dot(norm, lightDir), 0.0);
+        vec3 diffuse = diff * result_color;
 
-    result_color = ambient + diffuse;
+        result_color = ambient + diffuse;
+    }
 #endif
 
     FragColor = vec4(result_color, opacity);
@@ -1,5 +1,17 @@
 #version 330 core
 
+// attributes are read from an interleaved PSX_Vertex:
+// position is int16, color, uv and texture window are uint8 and
+// the normal is a signed normalized 2_10_10_10 integer.
+
+#if defined(DYNAMIC_BRANCHING)
+// every attribute is declared, those missing from the mesh read as
+// (0, 0, 0, 1) and are ignored by the fragment shader.
+#define MESH_HAS_COLORS
+#define MESH_HAS_UV
+#define MESH_HAS_NORMALS
+#endif
+
 layout(location = 0) in vec3 position;
 
 #if defined(MESH_HAS_COLORS)
@@ -8,15 +20,37 @@ layout(location = 2) in vec3 color;
 
 #if defined(MESH_HAS_UV)
 layout(location = 3) in vec2 uv;
+layout(location = 5) in float texture_window;
 #endif
 
 #if defined(MESH_HAS_NORMALS)
 layout(location = 4) in vec3 normal;
 #endif
 
-uniform mat4 model_matrix;
-uniform mat4 view_matrix;
-uniform mat4 projection_matrix;
+// std140 blocks, see shaderinterface.h
+layout(std140) uniform FrameBlock
+{
+    mat4 view_matrix;
+    mat4 projection_matrix;
+    vec3 light_direction;
+    vec3 light_ambient;
+    vec3 light_diffuse;
+    float time; // in seconds
+};
+
+layout(std140) uniform ObjectBlock
+{
+    mat4 model_matrix;
+    mat3 normal_matrix; // transpose(inverse(mat3(model_matrix))), computed on the CPU
+    ivec4 animation; // baked node (-1 if not animated), first frame, frame count, loop start
+    vec4 animation_time; // frame at time 0, time offset
+};
+
+// the transforms of every node at every frame of the baked animations,
+// see BakedAnimations for the layout.
+uniform sampler2D baked_animations;
+
+const float BAKED_FRAMES_PER_SECOND = 20.0;
 
 #if defined(MESH_HAS_COLORS)
 out vec3 v_color;
@@ -24,16 +58,52 @@ out vec3 v_color;
 
 #if defined(MESH_HAS_UV)
 out vec2 v_uv;
+flat out int v_texture_window;
 #endif
 
 #if defined(MESH_HAS_NORMALS)
 out vec3 v_normal;
 #endif
 
+// returns the row of the current frame of the animated node
+int baked_frame()
+{
+    float frame = floor(animation_time.x + (time + animation_time.y) * BAKED_FRAMES_PER_SECOND);
+    float count = float(animation.z);
+    float loop_start = float(animation.w);
+
+    if (frame >= count)
+    {
+        frame = animation.w >= 0 ? loop_start + mod(frame - loop_start, count - loop_start) : count - 1.0;
+    }
+
+    return animation.y + int(max(frame, 0.0));
+}
+
 void main()
 {
+    mat4 model = model_matrix;
+    mat3 normal_model = normal_matrix;
+
+    if (animation.x >= 0)
+    {
+        int row = baked_frame();
+        int column = animation.x * 6;
+
+        // the texels are the rows of the matrices
+        mat4 node = transpose(mat4(texelFetch(baked_animations, ivec2(column, row), 0),
+                                   texelFetch(baked_animations, ivec2(column + 1, row), 0),
+                                   texelFetch(baked_animations, ivec2(column + 2, row), 0),
+                                   vec4(0.0, 0.0, 0.0, 1.0)));
+        mat3 node_normal = transpose(mat3(texelFetch(baked_animations, ivec2(column + 3, row), 0).xyz,
+                                          texelFetch(baked_animations, ivec2(column + 4, row), 0).xyz,
+                                          texelFetch(baked_animations, ivec2(column + 5, row), 0).xyz));
+        model = model_matrix * node;
+        normal_model = normal_matrix * node_normal;
+    }
+
     vec4 model_pos = vec4(position, 1.0);
-    gl_Position = projection_matrix * view_matrix * model_matrix * model_pos;
+    gl_Position = projection_matrix * view_matrix * model * model_pos;
 
 #if defined(MESH_HAS_COLORS)
     v_color = color;
@@ -41,13 +111,13 @@ void main()
 
 #if defined(MESH_HAS_UV)
     v_uv = uv;
+    v_texture_window = int(texture_window);
 #endif
 
 #if defined(MESH_HAS_NORMALS)
     // The model's normals need to be transformed, but the transform's
-    // scale need to be taken into account ; hence this non-trivial
-    // formula.
+    // scale need to be taken into account ; hence the normal matrix.
     // See https://learnopengl.com/Lighting/Basic-Lighting
-    v_normal = mat3(transpose(inverse(model_matrix))) * normal;
+    v_normal = normal_model * normal;
 #endif
 }
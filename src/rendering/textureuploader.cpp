@@ -0,0 +1,188 @@
+// Copyright (C) 2025 Vincent Chambrin
+// This file is part of the 'mmd-viewer' project
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "textureuploader.h"
+
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+
+#include <QDebug>
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+TextureUploader::TextureUploader(QOpenGLContext* renderContext)
+{
+  m_surface = std::make_unique<QOffscreenSurface>();
+  m_surface->setFormat(renderContext->format());
+  m_surface->create();
+
+  m_context = std::make_unique<QOpenGLContext>();
+  m_context->setFormat(renderContext->format());
+  m_context->setShareContext(renderContext);
+
+  if (!m_context->create() || !m_context->areSharing(m_context.get(), renderContext))
+  {
+    qDebug() << "could not create a shared context, textures will be uploaded synchronously";
+    m_context.reset();
+    return;
+  }
+
+  m_context->moveToThread(this);
+  start();
+}
+
+TextureUploader::~TextureUploader()
+{
+  stop();
+
+  // the context was given back to this thread at the end of run()
+  m_context.reset();
+  m_surface.reset();
+}
+
+bool TextureUploader::isValid() const
+{
+  return m_context != nullptr;
+}
+
+void TextureUploader::upload(TextureUpload request)
+{
+  {
+    QMutexLocker lock{&m_mutex};
+    m_requests.push_back(std::move(request));
+  }
+
+  m_condition.wakeOne();
+}
+
+std::vector<CompletedTextureUpload> TextureUploader::takeCompletedUploads()
+{
+  QMutexLocker lock{&m_mutex};
+  return std::exchange(m_completed, {});
+}
+
+void TextureUploader::stop()
+{
+  {
+    QMutexLocker lock{&m_mutex};
+    m_stop = true;
+  }
+
+  m_condition.wakeAll();
+  wait();
+}
+
+void TextureUploader::run()
+{
+  m_context->makeCurrent(m_surface.get());
+  QOpenGLExtraFunctions gl{m_context.get()};
+
+  gl.glGenBuffers(1, &m_pbo);
+
+  std::vector<TextureUpload> requests;
+
+  for (;;)
+  {
+    {
+      QMutexLocker lock{&m_mutex};
+
+      while (!m_stop && m_requests.empty())
+      {
+        m_condition.wait(&m_mutex);
+      }
+
+      if (m_stop)
+      {
+        requests = std::move(m_requests);
+        break;
+      }
+
+      requests = std::exchange(m_requests, {});
+    }
+
+    std::vector<CompletedTextureUpload> completed;
+    completed.reserve(requests.size());
+
+    for (TextureUpload& request : requests)
+    {
+      process(gl, request);
+
+      CompletedTextureUpload result;
+      result.texture = request.texture;
+      result.done = gl.glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+      completed.push_back(result);
+    }
+
+    // the fences must reach the GL before the render context waits on them
+    gl.glFlush();
+
+    QMutexLocker lock{&m_mutex};
+    m_completed.insert(m_completed.end(), completed.begin(), completed.end());
+  }
+
+  // pending requests are dropped, their textures are destroyed by the render context
+  for (TextureUpload& request : requests)
+  {
+    gl.glDeleteSync(request.allocated);
+  }
+
+  gl.glDeleteBuffers(1, &m_pbo);
+
+  m_context->doneCurrent();
+  m_context->moveToThread(thread());
+}
+
+void TextureUploader::process(QOpenGLExtraFunctions& gl, TextureUpload& request)
+{
+  // the texture storage was allocated by the render context
+  gl.glWaitSync(request.allocated, 0, GL_TIMEOUT_IGNORED);
+  gl.glDeleteSync(request.allocated);
+
+  gl.glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_pbo);
+
+  // orphaning the buffer lets the driver give us new memory if the
+  // previous upload is still in flight.
+  m_pbo_size = std::max(m_pbo_size, request.sizeInBytes);
+  gl.glBufferData(GL_PIXEL_UNPACK_BUFFER, GLsizeiptr(m_pbo_size), nullptr, GL_STREAM_DRAW);
+
+  void* dest = gl.glMapBufferRange(GL_PIXEL_UNPACK_BUFFER,
+                                   0,
+                                   GLsizeiptr(request.sizeInBytes),
+                                   GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+
+  if (dest)
+  {
+    std::memcpy(dest, request.pixels, request.sizeInBytes);
+    gl.glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+    gl.glPixelStorei(GL_UNPACK_ALIGNMENT, request.alignment);
+    gl.glBindTexture(GL_TEXTURE_2D, request.texture);
+    gl.glTexSubImage2D(GL_TEXTURE_2D,
+                       0,
+                       0,
+                       0,
+                       request.size.width(),
+                       request.size.height(),
+                       request.format,
+                       request.type,
+                       nullptr);
+
+    if (request.generateMipMaps)
+    {
+      gl.glGenerateMipmap(GL_TEXTURE_2D);
+    }
+
+    gl.glBindTexture(GL_TEXTURE_2D, 0);
+  }
+  else
+  {
+    qDebug() << "could not map the pixel buffer, texture" << request.texture << "was not uploaded";
+  }
+
+  gl.glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+  request.owner.reset();
+}
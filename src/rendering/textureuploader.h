@@ -0,0 +1,105 @@
+// Copyright (C) 2025 Vincent Chambrin
+// This file is part of the 'mmd-viewer' project
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include <QMutex>
+#include <QOpenGLExtraFunctions>
+#include <QSize>
+#include <QThread>
+#include <QWaitCondition>
+
+#include <memory>
+#include <vector>
+
+class QOffscreenSurface;
+class QOpenGLContext;
+
+/**
+ * @brief the pixels of a texture to upload from the background thread
+ *
+ * The texture must have been created and its storage allocated by the
+ * render context; 'allocated' is a fence inserted after the allocation,
+ * so that the upload context does not write to the texture too early.
+ */
+struct TextureUpload
+{
+  GLuint texture = 0;
+  QSize size;
+  GLenum format = GL_BGRA;
+  GLenum type = GL_UNSIGNED_INT_8_8_8_8_REV;
+  int alignment = 4;
+  bool generateMipMaps = false;
+
+  std::shared_ptr<const void> owner; ///< keeps 'pixels' alive until the upload is done
+  const void* pixels = nullptr;
+  size_t sizeInBytes = 0;
+
+  GLsync allocated = nullptr;
+};
+
+/**
+ * @brief an upload that was submitted to the GL by the background thread
+ *
+ * The texture can be used by the render context once 'done' is signaled,
+ * the render context is then responsible for deleting the fence.
+ */
+struct CompletedTextureUpload
+{
+  GLuint texture = 0;
+  GLsync done = nullptr;
+};
+
+/**
+ * @brief uploads textures from a background thread
+ *
+ * The uploader owns an OpenGL context that shares its objects with the
+ * render context. Pixels are copied into a pixel buffer object by the
+ * CPU and then transferred to the texture by the GL, without blocking
+ * the render thread.
+ *
+ * The uploader must be created from the thread that owns the render context.
+ */
+class TextureUploader : public QThread
+{
+public:
+  explicit TextureUploader(QOpenGLContext* renderContext);
+  ~TextureUploader();
+
+  /**
+   * @brief returns whether the upload context could be created
+   *
+   * Textures must be uploaded synchronously if this returns false.
+   */
+  bool isValid() const;
+
+  void upload(TextureUpload request);
+  std::vector<CompletedTextureUpload> takeCompletedUploads();
+
+  /**
+   * @brief stops the background thread, dropping the pending requests
+   *
+   * The uploads completed so far can still be taken, after which no
+   * other upload completes. This is also done by the destructor.
+   */
+  void stop();
+
+protected:
+  void run() override;
+
+private:
+  void process(QOpenGLExtraFunctions& gl, TextureUpload& request);
+
+private:
+  std::unique_ptr<QOffscreenSurface> m_surface;
+  std::unique_ptr<QOpenGLContext> m_context;
+  GLuint m_pbo = 0;
+  size_t m_pbo_size = 0;
+
+  QMutex m_mutex;
+  QWaitCondition m_condition;
+  bool m_stop = false;
+  std::vector<TextureUpload> m_requests;
+  std::vector<CompletedTextureUpload> m_completed;
+};
@@ -76,10 +76,10 @@ std::unique_ptr<QOpenGLShaderProgram> compile_shader(const QByteArray& vertex,
 {
   auto sp = std::make_unique<QOpenGLShaderProgram>();
 
-  sp->addShaderFromSourceCode(QOpenGLShader::Vertex,
-                              glsl::prepare_shader(vertex, defines, vars));
-  sp->addShaderFromSourceCode(QOpenGLShader::Fragment,
-                              glsl::prepare_shader(fragment, defines, vars));
+  sp->addCacheableShaderFromSourceCode(QOpenGLShader::Vertex,
+                                       glsl::prepare_shader(vertex, defines, vars));
+  sp->addCacheableShaderFromSourceCode(QOpenGLShader::Fragment,
+                                       glsl::prepare_shader(fragment, defines, vars));
 
   sp->link();
 
@@ -135,10 +135,10 @@ UberShaderGetInstanceResult UberShader::getInstance(glsl::PreprocessorDefines de
   result.cached = false;
   auto sp = std::make_shared<QOpenGLShaderProgram>();
 
-  sp->addShaderFromSourceCode(QOpenGLShader::Vertex,
-                              glsl::prepare_shader(vertexShaderSourceCode(), conf.defines, conf.variables));
-  sp->addShaderFromSourceCode(QOpenGLShader::Fragment,
-                              glsl::prepare_shader(fragmentShaderSourceCode(), conf.defines, conf.variables));
+  sp->addCacheableShaderFromSourceCode(QOpenGLShader::Vertex,
+                                       glsl::prepare_shader(vertexShaderSourceCode(), conf.defines, conf.variables));
+  sp->addCacheableShaderFromSourceCode(QOpenGLShader::Fragment,
+                                       glsl::prepare_shader(fragmentShaderSourceCode(), conf.defines, conf.variables));
 
   if (sp->link())
   {
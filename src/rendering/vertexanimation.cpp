@@ -0,0 +1,50 @@
+// Copyright (C) 2025 Vincent Chambrin
+// This file is part of the 'mmd-viewer' project
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "vertexanimation.h"
+
+#include <QElapsedTimer>
+
+#include <cassert>
+
+BakedAnimations::BakedAnimations(int nodeCount)
+    : nodeCount(nodeCount)
+{}
+
+void BakedAnimations::appendFrame(const std::vector<QMatrix4x4>& transforms)
+{
+  assert(int(transforms.size()) == nodeCount);
+
+  texels.reserve(texels.size() + size_t(width()) * 4);
+
+  for (const QMatrix4x4& m : transforms)
+  {
+    // rows of the affine part, the last row is always (0, 0, 0, 1)
+    for (int row(0); row < 3; ++row)
+    {
+      texels.insert(texels.end(), {m(row, 0), m(row, 1), m(row, 2), m(row, 3)});
+    }
+
+    const QMatrix3x3 normal = m.normalMatrix();
+
+    for (int row(0); row < 3; ++row)
+    {
+      texels.insert(texels.end(), {normal(row, 0), normal(row, 1), normal(row, 2), 0.f});
+    }
+  }
+
+  ++frameCount;
+}
+
+float VertexAnimatedObject::currentTime()
+{
+  static QElapsedTimer clock;
+
+  if (!clock.isValid())
+  {
+    clock.start();
+  }
+
+  return float(clock.nsecsElapsed() / 1000) / 1e6f;
+}
@@ -0,0 +1,184 @@
+// Copyright (C) 2025 Vincent Chambrin
+// This file is part of the 'mmd-viewer' project
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "object3d.h"
+
+#include "math/aabb.h"
+
+#include <QMatrix4x4>
+
+#include <memory>
+#include <vector>
+
+/**
+ * @brief the transforms of the nodes of a hierarchy, evaluated ahead of time for each frame of a set of clips
+ *
+ * The data is laid out as the RGBA32F texture read by psxmodel.vert:
+ * each row is a frame and each node takes TEXELS_PER_NODE texels, the
+ * three rows of its 3x4 transform followed by the three rows of its
+ * normal matrix. Clips are stacked vertically.
+ *
+ * Transforms are relative to the parent of the animated object.
+ */
+class BakedAnimations : public std::enable_shared_from_this<BakedAnimations>
+{
+public:
+  static constexpr int TEXELS_PER_NODE = 6;
+  static constexpr int FRAMES_PER_SECOND = 20; // must match psxmodel.vert
+
+  struct Clip
+  {
+    int firstFrame = 0; ///< row of the first frame of the clip
+    int frameCount = 0;
+    int loopStart = -1; ///< frame played after the last one, -1 to hold the last frame
+  };
+
+  int nodeCount = 0;
+  int frameCount = 0;
+  std::vector<Clip> clips;
+  std::vector<float> texels; ///< 4 floats per texel, width() texels per frame
+  AABB bounds;               ///< bounds of the meshes over all frames
+
+  explicit BakedAnimations(int nodeCount);
+
+  int width() const;
+  size_t sizeInBytes() const;
+
+  /**
+   * @brief returns whether the texture fits in the GL_MAX_TEXTURE_SIZE of a context
+   */
+  bool fitsInTexture(int maxTextureSize) const;
+
+  /**
+   * @brief appends a row holding the transform of each node
+   */
+  void appendFrame(const std::vector<QMatrix4x4>& transforms);
+};
+
+inline int BakedAnimations::width() const
+{
+  return nodeCount * TEXELS_PER_NODE;
+}
+
+inline size_t BakedAnimations::sizeInBytes() const
+{
+  return texels.size() * sizeof(float);
+}
+
+inline bool BakedAnimations::fitsInTexture(int maxTextureSize) const
+{
+  return width() <= maxTextureSize && frameCount <= maxTextureSize;
+}
+
+/**
+ * @brief an object whose descendants can be animated by the vertex shader
+ *
+ * While a clip of its BakedAnimations is playing, the renderer ignores
+ * the local transforms of the animated nodes (the object included) and
+ * draws each of them with the world transform of the object's parent
+ * times the transform baked for the node at the current frame.
+ * The frame is computed by the shader from currentTime(),
+ * so that playing a clip costs nothing on the CPU.
+ *
+ * Instances are placed by their parent, e.g. a Group.
+ */
+class VertexAnimatedObject : public Object3D
+{
+public:
+  /**
+   * @brief the clip an instance plays
+   *
+   * At time t (see currentTime()), the frame
+   * frame + (t + timeOffset) * FRAMES_PER_SECOND of the clip is drawn.
+   */
+  struct Playback
+  {
+    int clip = -1;
+    float frame = 0;
+    float timeOffset = 0;
+  };
+
+  const std::shared_ptr<BakedAnimations>& bakedAnimations() const;
+  void setBakedAnimations(std::shared_ptr<BakedAnimations> animations);
+
+  const Playback& playback() const;
+  void setPlayback(const Playback& playback);
+  void stopPlayback();
+
+  /**
+   * @brief plays a clip from its first frame
+   */
+  void play(int clip);
+
+  /**
+   * @brief returns the time baked animations are played at, in seconds
+   *
+   * The clock is shared by all the renderers and starts on the first call.
+   */
+  static float currentTime();
+
+  /**
+   * @brief returns the clip being played, or nullptr if the nodes use their local transforms
+   */
+  const BakedAnimations::Clip* playingClip() const;
+
+  /**
+   * @brief returns the index of a descendant in the baked animations, -1 if it is not animated
+   */
+  virtual int animatedNodeIndex(const Object3D* node) const;
+
+private:
+  std::shared_ptr<BakedAnimations> m_baked_animations;
+  Playback m_playback;
+};
+
+inline const std::shared_ptr<BakedAnimations>& VertexAnimatedObject::bakedAnimations() const
+{
+  return m_baked_animations;
+}
+
+inline void VertexAnimatedObject::setBakedAnimations(std::shared_ptr<BakedAnimations> animations)
+{
+  m_baked_animations = std::move(animations);
+}
+
+inline const VertexAnimatedObject::Playback& VertexAnimatedObject::playback() const
+{
+  return m_playback;
+}
+
+inline void VertexAnimatedObject::setPlayback(const Playback& playback)
+{
+  m_playback = playback;
+}
+
+inline void VertexAnimatedObject::stopPlayback()
+{
+  m_playback = Playback();
+}
+
+inline void VertexAnimatedObject::play(int clip)
+{
+  Playback playback;
+  playback.clip = clip;
+  playback.timeOffset = -currentTime();
+  setPlayback(playback);
+}
+
+inline const BakedAnimations::Clip* VertexAnimatedObject::playingClip() const
+{
+  if (!m_baked_animations || m_playback.clip < 0 || m_playback.clip >= int(m_baked_animations->clips.size()))
+  {
+    return nullptr;
+  }
+
+  return &m_baked_animations->clips[m_playback.clip];
+}
+
+inline int VertexAnimatedObject::animatedNodeIndex(const Object3D* /* node */) const
+{
+  return -1;
+}
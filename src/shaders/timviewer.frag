@@ -0,0 +1,59 @@
+#version 330 core
+
+uniform usampler2D image; // raw 16-bit words of the TIM
+uniform usampler2D clut;  // raw 16-bit colors, one palette per row
+uniform int bpp;
+uniform int palette;
+
+in vec2 v_texel;
+
+out vec4 FragColor;
+
+// converts a A1B5G5R5 color, see psx16_to_argb()
+vec4 psx_color(uint c)
+{
+    vec3 rgb = vec3(uvec3(c, c >> 5u, c >> 10u) & 31u) / 31.0;
+    float alpha = (c & 0x8000u) != 0u ? 0.0 : 1.0;
+
+    // black is transparent, unless the stp bit is set
+    if ((c & 0x7FFFu) == 0u)
+    {
+        alpha = 1.0 - alpha;
+    }
+
+    return vec4(rgb, alpha);
+}
+
+uint word_at(int x, int y)
+{
+    return texelFetch(image, ivec2(x, y), 0).r;
+}
+
+void main()
+{
+    ivec2 texel = ivec2(floor(v_texel));
+
+    if (bpp == 4)
+    {
+        uint index = (word_at(texel.x >> 2, texel.y) >> uint((texel.x & 3) * 4)) & 0xFu;
+        FragColor = psx_color(texelFetch(clut, ivec2(int(index), palette), 0).r);
+    }
+    else if (bpp == 8)
+    {
+        uint index = (word_at(texel.x >> 1, texel.y) >> uint((texel.x & 1) * 8)) & 0xFFu;
+        FragColor = psx_color(texelFetch(clut, ivec2(int(index), palette), 0).r);
+    }
+    else if (bpp == 16)
+    {
+        FragColor = psx_color(word_at(texel.x, texel.y));
+    }
+    else
+    {
+        // 24-bit pixels are R, G, B bytes and may straddle two words
+        int offset = texel.x * 3;
+        uint w0 = word_at(offset >> 1, texel.y);
+        uint w1 = word_at((offset >> 1) + 1, texel.y);
+        uvec3 rgb = (offset & 1) == 0 ? uvec3(w0, w0 >> 8u, w1) : uvec3(w0 >> 8u, w1, w1 >> 8u);
+        FragColor = vec4(vec3(rgb & 0xFFu) / 255.0, 1.0);
+    }
+}
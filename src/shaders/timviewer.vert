@@ -0,0 +1,19 @@
+#version 330 core
+
+// draws a quad covering a TIM image, without vertex buffer
+
+uniform vec2 viewport_size; // in pixels
+uniform vec2 origin;        // top-left corner of the image in the viewport, in pixels
+uniform vec2 image_size;    // in image pixels
+uniform float zoom;
+
+out vec2 v_texel;
+
+void main()
+{
+    vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);
+    v_texel = corner * image_size;
+
+    vec2 pos = (origin + v_texel * zoom) / viewport_size * 2.0 - 1.0;
+    gl_Position = vec4(pos.x, -pos.y, 0.0, 1.0);
+}
@@ -0,0 +1,89 @@
+// Copyright (C) 2025 Vincent Chambrin
+// This file is part of the 'mmd-viewer' project
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+/**
+ * @brief passes values from a producer thread to a consumer thread without locks
+ *
+ * Each thread owns one of the three slots, the third one holds the last
+ * published value. The producer publishes its slot by swapping it with
+ * that middle slot, and the consumer takes the middle slot the same way
+ * when it holds a value it has not seen yet. Neither thread ever waits:
+ * the producer may publish several values between two reads, the
+ * consumer then only sees the latest one.
+ */
+template<typename T>
+class TripleBuffer
+{
+public:
+  TripleBuffer() = default;
+  TripleBuffer(const TripleBuffer&) = delete;
+
+  /**
+   * @brief returns the slot the producer writes to
+   *
+   * It still holds whatever value was last written there.
+   */
+  T& writeBuffer();
+
+  /**
+   * @brief makes the content of the write buffer available to the consumer
+   */
+  void publish();
+
+  /**
+   * @brief takes the latest published value, if any
+   * @return whether readBuffer() changed
+   */
+  bool update();
+
+  const T& readBuffer() const;
+
+private:
+  static constexpr uint8_t INDEX_MASK = 3;
+  static constexpr uint8_t NEW_BIT = 4; ///< set in 'm_middle' when it was published and not read yet
+
+  std::array<T, 3> m_slots;
+  uint8_t m_write = 0;
+  std::atomic<uint8_t> m_middle{1};
+  uint8_t m_read = 2;
+};
+
+template<typename T>
+inline T& TripleBuffer<T>::writeBuffer()
+{
+  return m_slots[m_write];
+}
+
+template<typename T>
+inline void TripleBuffer<T>::publish()
+{
+  // release the writes to the slot, acquire the slot given back by the consumer
+  const uint8_t previous = m_middle.exchange(m_write | NEW_BIT, std::memory_order_acq_rel);
+  m_write = previous & INDEX_MASK;
+}
+
+template<typename T>
+inline bool TripleBuffer<T>::update()
+{
+  if (!(m_middle.load(std::memory_order_relaxed) & NEW_BIT))
+  {
+    return false;
+  }
+
+  const uint8_t previous = m_middle.exchange(m_read, std::memory_order_acq_rel);
+  m_read = previous & INDEX_MASK;
+  return true;
+}
+
+template<typename T>
+inline const T& TripleBuffer<T>::readBuffer() const
+{
+  return m_slots[m_read];
+}
@@ -5,6 +5,7 @@
 #include "sceneviewer.h"
 
 #include <QHBoxLayout>
+#include <QTimer>
 
 #include <QDebug>
 
@@ -36,6 +37,12 @@ void CharacterViewer::init()
 {
   m_viewer = new SceneViewer(this);
 
+  // with baked animations, the frame is computed by the renderer
+  m_bakedAnimations = qEnvironmentVariableIntValue("MMDVIEWER_BAKED_ANIMATIONS") == 1;
+  m_repaintTimer = new QTimer(this);
+  m_repaintTimer->setInterval(1000 / BakedAnimations::FRAMES_PER_SECOND);
+  connect(m_repaintTimer, &QTimer::timeout, m_viewer, qOverload<>(&SceneViewer::update));
+
   auto* layout = new QHBoxLayout(this);
   layout->addWidget(m_viewer, 1);
 }
@@ -64,6 +71,7 @@ void CharacterViewer::reset(const CharacterEntry& characterEntry)
     m_player = nullptr;
   }
 
+  m_repaintTimer->stop();
   m_viewer->sceneRoot().clear();
 
   auto model = std::make_unique<CharacterModel>(characterEntry, mmd);
@@ -93,6 +101,25 @@ void CharacterViewer::playAnimation(int index)
   if (index < 0 || index >= m_model->animations.size())
     return;
 
+  if (m_bakedAnimations)
+  {
+    if (!m_model->bakedAnimations())
+    {
+      m_model->setBakedAnimations(bake_animations(*m_model));
+    }
+
+    // long clips or many nodes may not fit in a texture, they are then played on the CPU
+    if (m_model->bakedAnimations()->fitsInTexture(m_viewer->maxTextureSize()))
+    {
+      m_model->play(index);
+      m_repaintTimer->start();
+      return;
+    }
+
+    m_model->stopPlayback();
+    m_repaintTimer->stop();
+  }
+
   if (!m_player)
   {
     m_player = new AnimationPlayer(*m_model, this);
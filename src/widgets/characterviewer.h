@@ -13,6 +13,8 @@ class AnimationPlayer;
 class CharacterModel;
 class SceneViewer;
 
+class QTimer;
+
 class CharacterViewer : public QWidget
 {
   Q_OBJECT
@@ -40,4 +42,6 @@ private:
   SceneViewer* m_viewer;
   CharacterModel* m_model;
   AnimationPlayer* m_player = nullptr;
+  bool m_bakedAnimations = false; ///< play animations on the GPU, see VertexAnimatedObject
+  QTimer* m_repaintTimer;
 };
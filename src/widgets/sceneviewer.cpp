@@ -46,6 +46,11 @@ Group& SceneViewer::sceneRoot() const
   return d->sceneRoot;
 }
 
+int SceneViewer::maxTextureSize() const
+{
+  return d->sceneRenderer ? d->sceneRenderer->maxTextureSize() : 1024;
+}
+
 void SceneViewer::mousePressEvent(QMouseEvent* event)
 {
   d->cc.mousePressEvent(event, &d->viewport);
@@ -98,4 +103,10 @@ void SceneViewer::paintGL()
   renderer.projectionMatrix = proj;
 
   renderer.render(d->sceneRoot);
+
+  if (renderer.framePending())
+  {
+    // the frame that was drawn is one frame behind the scene
+    update();
+  }
 }
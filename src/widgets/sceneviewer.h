@@ -19,6 +19,13 @@ public:
 
   Group& sceneRoot() const;
 
+  /**
+   * @brief returns the GL_MAX_TEXTURE_SIZE of the renderer
+   *
+   * Until the context is initialized, this is the minimum required by OpenGL 3.3.
+   */
+  int maxTextureSize() const;
+
 protected:
   void mousePressEvent(QMouseEvent* event) override;
   void mouseMoveEvent(QMouseEvent* event) override;
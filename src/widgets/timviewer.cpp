@@ -1,20 +1,58 @@
 #include "timviewer.h"
 
-#include "converters/tim2image.h"
+#include <QOpenGLFunctions>
+#include <QOpenGLPixelTransferOptions>
+#include <QOpenGLShaderProgram>
+#include <QOpenGLTexture>
+#include <QOpenGLVertexArrayObject>
 
-#include <QPainter>
+#include <QKeyEvent>
+#include <QMouseEvent>
+#include <QWheelEvent>
+
+#include <algorithm>
+
+static std::unique_ptr<QOpenGLTexture> create_u16_texture(int width, int height, const u16* data)
+{
+  auto texture = std::make_unique<QOpenGLTexture>(QOpenGLTexture::Target2D);
+  texture->setFormat(QOpenGLTexture::R16U);
+  texture->setSize(width, height);
+  texture->setMipLevels(1);
+  texture->setMinMagFilters(QOpenGLTexture::Nearest, QOpenGLTexture::Nearest);
+  texture->allocateStorage(QOpenGLTexture::Red_Integer, QOpenGLTexture::UInt16);
+
+  QOpenGLPixelTransferOptions options;
+  options.setAlignment(2);
+  texture->setData(QOpenGLTexture::Red_Integer, QOpenGLTexture::UInt16, data, &options);
+
+  return texture;
+}
 
 TimViewer::TimViewer(QWidget* parent)
-    : QWidget(parent)
-{}
+    : QOpenGLWidget(parent)
+{
+  setFocusPolicy(Qt::StrongFocus);
+}
 
 TimViewer::TimViewer(const TimImage& img, QWidget* parent)
-    : QWidget(parent)
+    : TimViewer(parent)
 {
   setTimImage(img);
 }
 
-TimViewer::~TimViewer() {}
+TimViewer::~TimViewer()
+{
+  if (m_program)
+  {
+    makeCurrent();
+
+    releaseTextures();
+    m_vao.reset();
+    m_program.reset();
+
+    doneCurrent();
+  }
+}
 
 const TimImage& TimViewer::getTimImage() const
 {
@@ -23,36 +61,192 @@ const TimImage& TimViewer::getTimImage() const
 
 void TimViewer::setTimImage(const TimImage& img)
 {
+  // decoding is done by the shader, the raw data is uploaded on the next paint
   m_tim = img;
-  std::vector<QImage> images = tim2images(img);
-  m_pixmaps.clear();
-  m_pixmaps.reserve(images.size());
+  m_textures_outdated = true;
+
+  if (m_palette >= m_tim.numberOfPalettes())
+  {
+    m_palette = -1;
+  }
+
+  update();
+}
+
+int TimViewer::currentPalette() const
+{
+  return m_palette;
+}
+
+void TimViewer::setCurrentPalette(int index)
+{
+  index = std::clamp(index, -1, m_tim.numberOfPalettes() - 1);
 
-  for (const QImage& qimg : images)
+  if (index != m_palette)
   {
-    m_pixmaps.push_back(QPixmap::fromImage(qimg));
+    m_palette = index;
+    update();
   }
+}
 
+void TimViewer::resetView()
+{
+  m_zoom = 1;
+  m_pan = QPointF();
   update();
 }
 
-void TimViewer::paintEvent(QPaintEvent* ev)
+void TimViewer::initializeGL()
+{
+  m_program = std::make_unique<QOpenGLShaderProgram>();
+  m_program->addShaderFromSourceFile(QOpenGLShader::Vertex, QString(":/shaders/timviewer.vert"));
+  m_program->addShaderFromSourceFile(QOpenGLShader::Fragment, QString(":/shaders/timviewer.frag"));
+  m_program->link();
+
+  // the quad is generated from gl_VertexID, but core profiles still require a VAO
+  m_vao = std::make_unique<QOpenGLVertexArrayObject>();
+  m_vao->create();
+
+  m_textures_outdated = true;
+}
+
+void TimViewer::paintGL()
 {
-  Q_UNUSED(ev);
+  QOpenGLFunctions* gl = context()->functions();
+
+  const QColor cc = palette().window().color();
+  gl->glClearColor(cc.redF(), cc.greenF(), cc.blueF(), 1.0f);
+  gl->glClear(GL_COLOR_BUFFER_BIT);
+
+  if (m_tim.isNull())
+  {
+    return;
+  }
+
+  if (m_textures_outdated)
+  {
+    uploadTextures();
+  }
+
+  gl->glEnable(GL_BLEND);
+  gl->glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+  m_program->bind();
+  m_vao->bind();
+
+  m_image_texture->bind(0);
+  m_program->setUniformValue("image", 0);
 
-  QPainter painter{this};
+  if (m_clut_texture)
+  {
+    m_clut_texture->bind(1);
+    m_program->setUniformValue("clut", 1);
+  }
+
+  const QSizeF image_size(m_tim.width(), m_tim.height());
+  m_program->setUniformValue("viewport_size", QSizeF(size()));
+  m_program->setUniformValue("image_size", image_size);
+  m_program->setUniformValue("zoom", m_zoom);
+  m_program->setUniformValue("bpp", m_tim.bpp());
 
-  int x = 0;
-  int y = 0;
+  auto draw = [&](int paletteIndex, QPointF origin) {
+    m_program->setUniformValue("palette", paletteIndex);
+    m_program->setUniformValue("origin", origin);
+    gl->glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+  };
 
-  for (const QPixmap& pix : m_pixmaps)
+  if (m_palette == -1 && m_tim.numberOfPalettes() > 1)
   {
-    painter.drawPixmap(x, y, pix);
-    x += m_tim.width();
-    if (x + m_tim.width() > width())
+    // all palettes, wrapped to the width of the widget
+    const QSizeF tile_size = image_size * m_zoom;
+    const int columns = std::max(1, int(width() / tile_size.width()));
+
+    for (int i(0); i < m_tim.numberOfPalettes(); ++i)
     {
-      x = 0;
-      y += m_tim.height();
+      const QPointF tile(tile_size.width() * (i % columns), tile_size.height() * (i / columns));
+      draw(i, m_pan + tile);
     }
   }
+  else
+  {
+    draw(std::max(m_palette, 0), m_pan);
+  }
+
+  m_vao->release();
+  m_program->release();
+
+  gl->glDisable(GL_BLEND);
+}
+
+void TimViewer::mousePressEvent(QMouseEvent* event)
+{
+  m_last_mouse_pos = event->position();
+}
+
+void TimViewer::mouseMoveEvent(QMouseEvent* event)
+{
+  if (event->buttons() & Qt::LeftButton)
+  {
+    m_pan += event->position() - m_last_mouse_pos;
+    update();
+  }
+
+  m_last_mouse_pos = event->position();
+}
+
+void TimViewer::mouseDoubleClickEvent(QMouseEvent* event)
+{
+  Q_UNUSED(event);
+  resetView();
+}
+
+void TimViewer::wheelEvent(QWheelEvent* event)
+{
+  const float factor = event->angleDelta().y() > 0 ? 1.25f : 0.8f;
+  const float zoom = std::clamp(m_zoom * factor, 0.125f, 32.f);
+
+  // keep the point under the cursor in place
+  const QPointF cursor = event->position();
+  m_pan = cursor - (cursor - m_pan) * (zoom / m_zoom);
+  m_zoom = zoom;
+
+  update();
+}
+
+void TimViewer::keyPressEvent(QKeyEvent* event)
+{
+  switch (event->key())
+  {
+  case Qt::Key_Left:
+    setCurrentPalette(m_palette - 1);
+    break;
+  case Qt::Key_Right:
+    setCurrentPalette(m_palette + 1);
+    break;
+  default:
+    QOpenGLWidget::keyPressEvent(event);
+  }
+}
+
+void TimViewer::uploadTextures()
+{
+  releaseTextures();
+
+  m_image_texture = create_u16_texture(m_tim.pixelDataWidth(), m_tim.height(), m_tim.pixelData().data());
+
+  if (m_tim.usesPalette() && m_tim.numberOfPalettes() > 0)
+  {
+    const TimImage::Palettes& palettes = m_tim.palettes();
+    m_clut_texture = create_u16_texture(palettes.numberOfColorsPerPalette(),
+                                        palettes.numberOfPalettes(),
+                                        palettes.rawColors().data());
+  }
+
+  m_textures_outdated = false;
+}
+
+void TimViewer::releaseTextures()
+{
+  m_image_texture.reset();
+  m_clut_texture.reset();
 }
@@ -6,13 +6,28 @@
 
 #include "formats/tim.h"
 
-#include <QWidget>
+#include <QOpenGLWidget>
 
-#include <QPixmap>
+#include <QPointF>
 
-#include <vector>
+#include <memory>
 
-class TimViewer : public QWidget
+class QOpenGLShaderProgram;
+class QOpenGLTexture;
+class QOpenGLVertexArrayObject;
+
+/**
+ * @brief displays a TIM image, decoded on the GPU
+ *
+ * The raw pixel data and color palettes are uploaded once as integer
+ * textures and decoded by a shader, so that switching palette, zooming
+ * or panning does not decode the image again.
+ *
+ * The mouse wheel zooms, dragging with the left button pans and
+ * double-clicking resets the view. The left and right arrow keys
+ * select the palette.
+ */
+class TimViewer : public QOpenGLWidget
 {
   Q_OBJECT
 public:
@@ -23,10 +38,37 @@ public:
   const TimImage& getTimImage() const;
   void setTimImage(const TimImage& img);
 
+  /**
+   * @brief returns the displayed palette, -1 if all palettes are displayed side by side
+   */
+  int currentPalette() const;
+  void setCurrentPalette(int index);
+
+  void resetView();
+
 protected:
-  void paintEvent(QPaintEvent* ev) override;
+  void initializeGL() override;
+  void paintGL() override;
+
+  void mousePressEvent(QMouseEvent* event) override;
+  void mouseMoveEvent(QMouseEvent* event) override;
+  void mouseDoubleClickEvent(QMouseEvent* event) override;
+  void wheelEvent(QWheelEvent* event) override;
+  void keyPressEvent(QKeyEvent* event) override;
+
+private:
+  void uploadTextures();
+  void releaseTextures();
 
 private:
   TimImage m_tim;
-  std::vector<QPixmap> m_pixmaps;
+  int m_palette = -1;
+  float m_zoom = 1;
+  QPointF m_pan;
+  QPointF m_last_mouse_pos;
+  bool m_textures_outdated = true;
+  std::unique_ptr<QOpenGLShaderProgram> m_program;
+  std::unique_ptr<QOpenGLVertexArrayObject> m_vao;
+  std::unique_ptr<QOpenGLTexture> m_image_texture;
+  std::unique_ptr<QOpenGLTexture> m_clut_texture;
 };
@@ -52,6 +52,7 @@ void TMD_Viewer::paintGL()
   if (std::exchange(m_modelNeedsUpdate, false))
   {
     TMD_ModelConverter converter;
+    converter.setVramEmulation(true);
     converter.setTIMs(m_tims);
     auto obj3d = converter.convertModel(m_model);
     sceneRoot().clear();
@@ -9,6 +9,7 @@
 
 #include "formats/mmd.h"
 #include "gamereader.h"
+#include "jobsystem.h"
 
 #include <QFileDialog>
 #include <QMessageBox>
@@ -110,11 +111,16 @@ void MainWindow::openDirectory(const QString& directory)
     return;
   }
 
-  GameReader reader;
-  reader.readPSX_EXE(exeinfo.absoluteFilePath());
+  // the game files are read by the job system, the GUI stays responsive meanwhile
+  auto reader = std::make_shared<GameReader>();
+  const QString exepath = exeinfo.absoluteFilePath();
 
-  auto* viewer = new CharactersViewer(reader.result, this);
-  m_tab_widget->addTab(viewer, "Characters");
+  JobPtr job = JobSystem::instance().submit([reader, exepath]() { reader->readPSX_EXE(exepath); });
+
+  JobSystem::instance().then(job, this, [this, reader]() {
+    auto* viewer = new CharactersViewer(reader->result, this);
+    m_tab_widget->addTab(viewer, "Characters");
+  });
 }
 
 void MainWindow::open(const QString& filePath)